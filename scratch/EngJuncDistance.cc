@@ -32,87 +32,11 @@ using namespace std;
 #include "ns3/netanim-module.h"
 
 #include "ns3/flow-monitor-module.h"
-#include "ns3/seq-ts-header.h"
-#include "ns3/ocb-wifi-mac.h"
-#include "ns3/wifi-80211p-helper.h"
-#include "ns3/wave-mac-helper.h"
 
-using namespace ns3;
-
-int packetCount = 1;
+#include "junction-scenario.h"
+#include "junction-progress.h"
 
-//---------------------------------------------------------------------------------------
-//-- Calculates and returns the straight line distance (m) between two nodes and
-//-- returns as a double
-//---------------------------------------------------------------------------------------
-double
-CalcNodeDistance(Ptr<Node> node1, Ptr<Node> node2)
-{
-  Ptr<MobilityModel> model1 = node1->GetObject<MobilityModel>();
-  Ptr<MobilityModel> model2 = node2->GetObject<MobilityModel>();
-  double distance = model1->GetDistanceFrom (model2);
-  return distance;
-}
-
-//---------------------------------------------------------------------------------------
-//-- Callback function, called whenever a packet is received successfully. Prints stats to csv file.
-//---------------------------------------------------------------------------------------
-void ReceivePacket (Ptr<Node> node1, Ptr<Node> node2, Ptr<Socket> socket)
-{
-  Ptr<Packet> packet;
-  while (packet = socket->Recv ())
-    {
-
-      SeqTsHeader seqTs;
-      packet->RemoveHeader (seqTs);
-
-      //---------------------------------------------------------------------------------------
-      //-- Calculate end to end delay, transmission distance, and packet size
-      //---------------------------------------------------------------------------------------
-      int64_t now = Simulator::Now().GetNanoSeconds();
-      int64_t txTime = seqTs.GetTs().GetNanoSeconds();
-      int64_t delay = now - txTime;
-
-      double distance = CalcNodeDistance(node1, node2);
-
-      uint32_t size = packet->GetSize ();
-
-      //---------------------------------------------------------------------------------------
-      //-- Write results to CSV file, increment current packet counter
-      //---------------------------------------------------------------------------------------
-      std::ofstream datafile ("EngJuncData.csv", std::ios_base::app);
-      if (datafile.is_open())
-        {
-          datafile << ::packetCount << ", " << now << ", " << delay << ", " << distance << ", " << size << "\n";
-        }
-      
-      ++(::packetCount);
-        
-    }
-}
-
-
-//---------------------------------------------------------------------------------------
-//-- Create Recursive Traffic Generator
-//---------------------------------------------------------------------------------------
-static void GenerateTraffic (Ptr<Socket> socket, uint32_t pktSize,
-                             uint32_t pktCount, Time pktInterval )
-{
-  if (pktCount > 0)
-    {  
-      Ptr<Packet> pkt = Create<Packet> (pktSize);
-      SeqTsHeader hdr = SeqTsHeader();
-      pkt->AddHeader(hdr); 
-      socket->Send (pkt);
-
-      Simulator::Schedule (pktInterval, &GenerateTraffic,
-                           socket, pktSize, pktCount - 1, pktInterval);
-    }
-  else
-    {
-      socket->Close ();
-    }
-}
+using namespace ns3;
 
 //---------------------------------------------------------------------------------------
 //-- Main Function
@@ -129,6 +53,16 @@ main (int argc, char *argv[])
   uint32_t numPackets = 100;
   double interval = 0.1; // seconds
   Time interPacketInterval = Seconds (interval);
+  double binWidth = 5; // m
+  std::string traffic = "ip"; // ip = UDP broadcast, wsmp = raw OCB frames, no IP stack
+  Time stopTime = Seconds (60);
+  ProgressReporter reporter;
+
+  CommandLine cmd;
+  cmd.AddValue("binWidth", "Width of the distance bins (m)", binWidth);
+  cmd.AddValue("traffic", "Traffic path: ip or wsmp", traffic);
+  reporter.AddCommandLineOptions (cmd);
+  cmd.Parse(argc, argv);
   
   //-------------------------------------------------------------------------------------
   //-- Create Nodes
@@ -142,21 +76,9 @@ main (int argc, char *argv[])
   //-------------------------------------------------------------------------------------
   //-- Set up the Wi-Fi NICs
   //-------------------------------------------------------------------------------------
-  YansWifiPhyHelper wifiPhy =  YansWifiPhyHelper::Default ();
-  YansWifiChannelHelper wifiChannel = YansWifiChannelHelper::Default ();
-  Ptr<YansWifiChannel> channel = wifiChannel.Create ();
-  wifiPhy.SetChannel (channel);
-  wifiPhy.SetPcapDataLinkType (WifiPhyHelper::DLT_IEEE802_11); // ns-3 supports generate a pcap trace
-  NqosWaveMacHelper wifi80211pMac = NqosWaveMacHelper::Default ();
-  Wifi80211pHelper wifi80211p = Wifi80211pHelper::Default ();
-
-  wifi80211p.SetRemoteStationManager ("ns3::ConstantRateWifiManager",
-                                      "DataMode",StringValue (phyMode),
-                                      "ControlMode",StringValue (phyMode));
-  NetDeviceContainer sensorDevices = wifi80211p.Install (wifiPhy, wifi80211pMac, sensorNodes);
-  sensorDevices = wifi80211p.Install (wifiPhy, wifi80211pMac, sensorNodes);
-  NetDeviceContainer carDevices = wifi80211p.Install (wifiPhy, wifi80211pMac, carNodes);
-  carDevices = wifi80211p.Install (wifiPhy, wifi80211pMac, carNodes);
+  JunctionScenario scenario (phyMode, ParseTrafficMode (traffic));
+  NetDeviceContainer sensorDevices = scenario.InstallDevices (sensorNodes);
+  NetDeviceContainer carDevices = scenario.InstallDevices (carNodes);
 
 
 
@@ -183,41 +105,35 @@ main (int argc, char *argv[])
   }
  
   //---------------------------------------------------------------------------------------
-  //-- Setup the Internet stack and assign IPV4 addresses
+  //-- Setup the Internet stack and assign IPV4 addresses (skipped for wsmp traffic)
   //---------------------------------------------------------------------------------------
-  InternetStackHelper internet;
-  internet.Install (sensorNodes);
-  internet.Install (carNodes);
-
-  Ipv4AddressHelper ipv4;
-  ipv4.SetBase ("10.1.1.0", "255.255.255.0");
-  Ipv4InterfaceContainer sensorInterfaces = ipv4.Assign (sensorDevices);
-  ipv4.SetBase ("10.1.2.0", "255.255.255.0"); 
-  Ipv4InterfaceContainer carInterfaces = ipv4.Assign (carDevices);
+  Ipv4InterfaceContainer sensorInterfaces = scenario.InstallInternet (sensorDevices, "10.1.1.0");
+  Ipv4InterfaceContainer carInterfaces = scenario.InstallInternet (carDevices, "10.1.2.0");
 
   //---------------------------------------------------------------------------------------
-  //-- Setup socket connection and callback when packets are received by the source
+  //-- Setup socket connection and callback when packets are received by the source.
+  //-- Every packet is logged, and delay is also binned by Tx distance.
   //---------------------------------------------------------------------------------------
-  TypeId tid = TypeId::LookupByName ("ns3::UdpSocketFactory");
-  Ptr<Socket> recvSink = Socket::CreateSocket (carNodes.Get (0), tid);
-  InetSocketAddress local = InetSocketAddress (Ipv4Address::GetAny (), 80);
-  recvSink->Bind (local);
-  recvSink->SetRecvCallback (MakeBoundCallback (&ReceivePacket, sensorNodes.Get (0), carNodes.Get (0)));
+  typedef SinkPair<PacketTraceSink, DistanceBinSink> Measure;
+  PacketTraceSink trace ("EngJuncData.csv");
+  DistanceBinSink bins ("EngJuncDistanceBins.csv", binWidth);
+  Measure measure (trace, bins);
+  JunctionReceiver<Measure> receiver (measure, sensorNodes.Get (0), carNodes.Get (0));
+  scenario.ConnectReceiver (receiver, carDevices.Get (0), 80);
 
   //---------------------------------------------------------------------------------------
   //-- Begin broadcasting and generating traffic
   //---------------------------------------------------------------------------------------
-  Ptr<Socket> source = Socket::CreateSocket (sensorNodes.Get (0), tid);
-  InetSocketAddress remote = InetSocketAddress (Ipv4Address ("255.255.255.255"), 80);
-  source->SetAllowBroadcast (true);
-  source->Connect (remote);
-
-  Simulator::ScheduleWithContext (source->GetNode ()->GetId (),
-                                  Seconds (0), &GenerateTraffic,
-                                  source, packetSize, numPackets, interPacketInterval);
+  TrafficGenerator generator (packetSize, interPacketInterval);
+  scenario.ConnectSender (generator, sensorDevices.Get (0), 80);
+  generator.SetDoneCallback (MakeCallback (&Measure::OnTrafficDone, &measure));
+  generator.Start (Seconds (0), packetSize * numPackets);
   
 
-  Simulator::Stop (Seconds (60));
+  reporter.Start (stopTime, MakeCallback (&TrafficGenerator::GetSent, &generator),
+                  MakeCallback (&JunctionReceiver<Measure>::GetReceived, &receiver));
+
+  Simulator::Stop (stopTime);
   Simulator::Run ();
   Simulator::Destroy ();
   return 0;
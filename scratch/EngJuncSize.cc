@@ -32,91 +32,11 @@ using namespace std;
 #include "ns3/netanim-module.h"
 
 #include "ns3/flow-monitor-module.h"
-#include "ns3/seq-ts-header.h"
-#include "ns3/ocb-wifi-mac.h"
-#include "ns3/wifi-80211p-helper.h"
-#include "ns3/wave-mac-helper.h"
 
-using namespace ns3;
-
-//int packetCount = 1;
-int totalDelay = 0;
-
-//---------------------------------------------------------------------------------------
-//-- Calculates and returns the straight line distance (m) between two nodes and
-//-- returns as a double
-//---------------------------------------------------------------------------------------
-double
-CalcNodeDistance(Ptr<Node> node1, Ptr<Node> node2)
-{
-  Ptr<MobilityModel> model1 = node1->GetObject<MobilityModel>();
-  Ptr<MobilityModel> model2 = node2->GetObject<MobilityModel>();
-  double distance = model1->GetDistanceFrom (model2);
-  return distance;
-}
+#include "junction-scenario.h"
+#include "junction-progress.h"
 
-//---------------------------------------------------------------------------------------
-//-- Callback function, called whenever a packet is received successfully. Prints stats to csv file.
-//---------------------------------------------------------------------------------------
-void ReceivePacket (Ptr<Node> node1, Ptr<Node> node2, Ptr<Socket> socket)
-{
-  Ptr<Packet> packet;
-  while (packet = socket->Recv ())
-    {
-
-      SeqTsHeader seqTs;
-      packet->RemoveHeader (seqTs);
-
-      //---------------------------------------------------------------------------------------
-      //-- Calculate end to end delay, transmission distance, and packet size
-      //---------------------------------------------------------------------------------------
-      int64_t now = Simulator::Now().GetNanoSeconds();
-      int64_t txTime = seqTs.GetTs().GetNanoSeconds();
-      int64_t delay = now - txTime;
-
-      ::totalDelay += delay;
-        
-    }
-}
-
-
-//---------------------------------------------------------------------------------------
-//-- Create Recursive Traffic Generator
-//---------------------------------------------------------------------------------------
-static void GenerateTraffic (Ptr<Socket> socket, uint32_t maxPktSize,
-                             uint32_t pktCount, Time pktInterval, 
-                             uint32_t totalData, uint32_t dataLeft)
-{
-  //---------------------------------------------------------------------------------------
-  //-- If packets left, send
-  //---------------------------------------------------------------------------------------
-  uint32_t pktSize = maxPktSize;
-  if (pktCount > 0)
-    {  
-      if (dataLeft < maxPktSize)
-        {
-          pktSize = dataLeft;
-        }
-      Ptr<Packet> pkt = Create<Packet> (pktSize);
-      SeqTsHeader hdr = SeqTsHeader();
-      pkt->AddHeader(hdr); 
-      socket->Send (pkt);
-      Simulator::Schedule (pktInterval, &GenerateTraffic,
-                           socket, maxPktSize, pktCount - 1, pktInterval, totalData, dataLeft - pktSize);
-    }
-  //---------------------------------------------------------------------------------------
-  //-- If no packets left, log data and close socket
-  //---------------------------------------------------------------------------------------
-  else
-    {
-      std::ofstream datafile ("EngJuncSize.csv", std::ios_base::app);
-      if (datafile.is_open())
-        {
-          datafile << totalData << ", " << ::totalDelay << "\n";
-        }
-      socket->Close ();
-    }
-}
+using namespace ns3;
 
 //---------------------------------------------------------------------------------------
 //-- Main Function
@@ -133,9 +53,14 @@ main (int argc, char *argv[])
   uint32_t maxPacketSize = 1500; // bytes - MTU for IPv6 over 802.11p = 1500
   double t_interval = 0.1; // seconds
   Time interPacketInterval = Seconds (t_interval);
+  std::string traffic = "ip"; // ip = UDP broadcast, wsmp = raw OCB frames, no IP stack
+  Time stopTime = Seconds (600);
+  ProgressReporter reporter;
 
   CommandLine cmd;
   cmd.AddValue("totalData", "Total Data to transmit (in bytes)", totalData);
+  cmd.AddValue("traffic", "Traffic path: ip or wsmp", traffic);
+  reporter.AddCommandLineOptions (cmd);
   cmd.Parse(argc, argv);
   
   //-------------------------------------------------------------------------------------
@@ -147,19 +72,8 @@ main (int argc, char *argv[])
   //-------------------------------------------------------------------------------------
   //-- Set up the Wi-Fi NICs
   //-------------------------------------------------------------------------------------
-  YansWifiPhyHelper wifiPhy =  YansWifiPhyHelper::Default ();
-  YansWifiChannelHelper wifiChannel = YansWifiChannelHelper::Default ();
-  Ptr<YansWifiChannel> channel = wifiChannel.Create ();
-  wifiPhy.SetChannel (channel);
-  wifiPhy.SetPcapDataLinkType (WifiPhyHelper::DLT_IEEE802_11); // ns-3 supports generate a pcap trace
-  NqosWaveMacHelper wifi80211pMac = NqosWaveMacHelper::Default ();
-  Wifi80211pHelper wifi80211p = Wifi80211pHelper::Default ();
-
-  wifi80211p.SetRemoteStationManager ("ns3::ConstantRateWifiManager",
-                                      "DataMode",StringValue (phyMode),
-                                      "ControlMode",StringValue (phyMode));
-  NetDeviceContainer sensorDevices = wifi80211p.Install (wifiPhy, wifi80211pMac, sensorNodes);
-  sensorDevices = wifi80211p.Install (wifiPhy, wifi80211pMac, sensorNodes);
+  JunctionScenario scenario (phyMode, ParseTrafficMode (traffic));
+  NetDeviceContainer sensorDevices = scenario.InstallDevices (sensorNodes);
 
 
   //---------------------------------------------------------------------------------------
@@ -170,49 +84,32 @@ main (int argc, char *argv[])
   AnimationInterface::SetConstantPosition (sensorNodes.Get(1), 5, 20);
  
   //---------------------------------------------------------------------------------------
-  //-- Setup the Internet stack and assign IPV4 addresses
+  //-- Setup the Internet stack and assign IPV4 addresses (skipped for wsmp traffic)
   //---------------------------------------------------------------------------------------
-  InternetStackHelper internet;
-  internet.Install (sensorNodes);
-
-  Ipv4AddressHelper ipv4;
-  ipv4.SetBase ("10.1.1.0", "255.255.255.0");
-  Ipv4InterfaceContainer sensorInterfaces = ipv4.Assign (sensorDevices);
+  Ipv4InterfaceContainer sensorInterfaces = scenario.InstallInternet (sensorDevices, "10.1.1.0");
 
   //---------------------------------------------------------------------------------------
-  //-- Setup socket connection and callback when packets are received by the source
+  //-- Setup socket connection and callback when packets are received by the source.
+  //-- Only the total delay is measured.
   //---------------------------------------------------------------------------------------
-  TypeId tid = TypeId::LookupByName ("ns3::UdpSocketFactory");
-  Ptr<Socket> recvSink = Socket::CreateSocket (sensorNodes.Get (1), tid);
-  InetSocketAddress local = InetSocketAddress (Ipv4Address::GetAny (), 80);
-  recvSink->Bind (local);
-  recvSink->SetRecvCallback (MakeBoundCallback (&ReceivePacket, sensorNodes.Get (0), sensorNodes.Get (1)));
+  TotalsSink totals ("EngJuncSize.csv");
+  JunctionReceiver<TotalsSink> receiver (totals, sensorNodes.Get (0), sensorNodes.Get (1));
+  scenario.ConnectReceiver (receiver, sensorDevices.Get (1), 80);
 
   //---------------------------------------------------------------------------------------
   //-- Begin broadcasting and generating traffic
   //---------------------------------------------------------------------------------------
-  Ptr<Socket> source = Socket::CreateSocket (sensorNodes.Get (0), tid);
-  InetSocketAddress remote = InetSocketAddress (Ipv4Address ("255.255.255.255"), 80);
-  source->SetAllowBroadcast (true);
-  source->Connect (remote);
+  TrafficGenerator generator (maxPacketSize, interPacketInterval);
+  scenario.ConnectSender (generator, sensorDevices.Get (0), 80);
   AnimationInterface anim ("test.xml");
 
-  //---------------------------------------------------------------------------------------
-  //-- Calc number of packets needed, if there's a remainder since the datatypes are ints,
-  //-- the program will round down, this is accounted for in the if loop
-  //---------------------------------------------------------------------------------------
-  uint32_t numPackets = totalData/maxPacketSize;
-  if (std::abs(std::remainder(totalData, maxPacketSize)) != 0)
-   {
-     ++numPackets;
-   }
-
-  Simulator::ScheduleWithContext (source->GetNode ()->GetId (),
-                                  Seconds (2), &GenerateTraffic,
-                                  source, maxPacketSize, numPackets, 
-                                  interPacketInterval, totalData, totalData);
-
-  Simulator::Stop (Seconds (600));
+  generator.SetDoneCallback (MakeCallback (&TotalsSink::OnTrafficDone, &totals));
+  generator.Start (Seconds (2), totalData);
+
+  reporter.Start (stopTime, MakeCallback (&TrafficGenerator::GetSent, &generator),
+                  MakeCallback (&JunctionReceiver<TotalsSink>::GetReceived, &receiver));
+
+  Simulator::Stop (stopTime);
   Simulator::Run ();
   Simulator::Destroy ();
   return 0;
@@ -0,0 +1,316 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef JUNCTION_EMU_BRIDGE_H
+#define JUNCTION_EMU_BRIDGE_H
+
+//---------------------------------------------------------------------------------------
+//-- Real-time emulation helpers. LoopbackBridge connects an ns-3 node's UDP sockets to a
+//-- host UDP socket on 127.0.0.1 so an external process (e.g. real RSU software) can
+//-- send and receive through the simulated 802.11p channel. RealtimeLagMonitor samples
+//-- how far the simulation clock falls behind the wall clock.
+//--
+//-- Both must be used with ns3::RealtimeSimulatorImpl, the bridge's reader thread relies
+//-- on it to schedule events safely from outside the simulation thread.
+//---------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "ns3/core-module.h"
+#include "ns3/network-module.h"
+#include "ns3/seq-ts-header.h"
+#include "ns3/unix-fd-reader.h"
+
+namespace ns3 {
+
+//---------------------------------------------------------------------------------------
+//-- Reads datagrams from the host socket on a separate thread
+//---------------------------------------------------------------------------------------
+class LoopbackBridgeReader : public FdReader
+{
+private:
+  FdReader::Data DoRead (void)
+  {
+    uint32_t bufferSize = 65536;
+    uint8_t *buf = (uint8_t *)std::malloc (bufferSize);
+    NS_ABORT_MSG_IF (buf == 0, "LoopbackBridgeReader: malloc failed");
+
+    //---------------------------------------------------------------------------------------
+    //-- FdReader stops on a length of 0 and ignores negative lengths. An empty datagram
+    //-- (e.g. a keepalive) or an interrupted read is ignored; only a real socket error
+    //-- ends the reader.
+    //---------------------------------------------------------------------------------------
+    ssize_t len = ::recv (m_fd, buf, bufferSize, 0);
+    if (len <= 0)
+      {
+        std::free (buf);
+        buf = 0;
+        if (len == 0 || errno == EINTR || errno == EAGAIN)
+          {
+            len = -1;
+          }
+        else
+          {
+            len = 0;
+          }
+      }
+    return FdReader::Data (buf, len);
+  }
+};
+
+class LoopbackBridge : public SimpleRefCount<LoopbackBridge>
+{
+public:
+  LoopbackBridge (uint16_t localPort, uint16_t peerPort)
+    : m_localPort (localPort),
+      m_peerPort (peerPort),
+      m_fd (-1),
+      m_seq (0),
+      m_fromHost (0),
+      m_toHost (0)
+  {
+  }
+
+  //---------------------------------------------------------------------------------------
+  //-- Datagrams from the host are sent out of 'source'; packets received on 'sink' are
+  //-- passed to the host peer. Both sockets should belong to the bridged node.
+  //---------------------------------------------------------------------------------------
+  void Start (Ptr<Socket> source, Ptr<Socket> sink)
+  {
+    m_source = source;
+    m_sink = sink;
+    m_sink->SetRecvCallback (MakeCallback (&LoopbackBridge::ReceiveFromChannel, this));
+
+    m_fd = ::socket (AF_INET, SOCK_DGRAM, 0);
+    NS_ABORT_MSG_IF (m_fd < 0, "LoopbackBridge: socket() failed: " << std::strerror (errno));
+
+    struct sockaddr_in local;
+    std::memset (&local, 0, sizeof (local));
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+    local.sin_port = htons (m_localPort);
+    int status = ::bind (m_fd, (struct sockaddr *)&local, sizeof (local));
+    NS_ABORT_MSG_IF (status < 0, "LoopbackBridge: bind() to port " << m_localPort << " failed: " << std::strerror (errno));
+
+    std::memset (&m_peer, 0, sizeof (m_peer));
+    m_peer.sin_family = AF_INET;
+    m_peer.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+    m_peer.sin_port = htons (m_peerPort);
+
+    m_reader = Create<LoopbackBridgeReader> ();
+    m_reader->Start (m_fd, MakeCallback (&LoopbackBridge::ReadCallback, this));
+  }
+
+  void Stop (void)
+  {
+    if (m_reader != 0)
+      {
+        m_reader->Stop ();
+        m_reader = 0;
+      }
+    if (m_fd >= 0)
+      {
+        ::close (m_fd);
+        m_fd = -1;
+      }
+  }
+
+  uint64_t GetFromHost (void) const
+  {
+    return m_fromHost;
+  }
+
+  uint64_t GetToHost (void) const
+  {
+    return m_toHost;
+  }
+
+private:
+  //---------------------------------------------------------------------------------------
+  //-- Called on the reader thread, hand the datagram over to the simulation thread
+  //---------------------------------------------------------------------------------------
+  void ReadCallback (uint8_t *buf, ssize_t len)
+  {
+    Simulator::ScheduleWithContext (m_source->GetNode ()->GetId (), Seconds (0),
+                                    MakeEvent (&LoopbackBridge::ForwardToChannel, this, buf, len));
+  }
+
+  //---------------------------------------------------------------------------------------
+  //-- Host -> channel. A SeqTsHeader is added so receivers can measure delay as usual
+  //---------------------------------------------------------------------------------------
+  void ForwardToChannel (uint8_t *buf, ssize_t len)
+  {
+    Ptr<Packet> pkt = Create<Packet> (buf, len);
+    std::free (buf);
+    SeqTsHeader hdr = SeqTsHeader ();
+    hdr.SetSeq (m_seq++);
+    pkt->AddHeader (hdr);
+    m_source->Send (pkt);
+    ++m_fromHost;
+  }
+
+  //---------------------------------------------------------------------------------------
+  //-- Channel -> host, the SeqTsHeader is stripped so the host sees its own payload
+  //---------------------------------------------------------------------------------------
+  void ReceiveFromChannel (Ptr<Socket> socket)
+  {
+    Ptr<Packet> packet;
+    while ((packet = socket->Recv ()))
+      {
+        SeqTsHeader seqTs;
+        packet->RemoveHeader (seqTs);
+        uint32_t size = packet->GetSize ();
+        uint8_t *buf = new uint8_t[size];
+        packet->CopyData (buf, size);
+        ::sendto (m_fd, buf, size, 0, (struct sockaddr *)&m_peer, sizeof (m_peer));
+        delete [] buf;
+        ++m_toHost;
+      }
+  }
+
+  uint16_t m_localPort;
+  uint16_t m_peerPort;
+  int m_fd;
+  struct sockaddr_in m_peer;
+  uint32_t m_seq;
+  uint64_t m_fromHost;
+  uint64_t m_toHost;
+  Ptr<Socket> m_source;
+  Ptr<Socket> m_sink;
+  Ptr<LoopbackBridgeReader> m_reader;
+};
+
+//---------------------------------------------------------------------------------------
+//-- Samples the simulation clock against the wall clock every 'period' of simulated
+//-- time. Lag is how far the simulation is behind wall-clock time; jitter is how far
+//-- each sample's wall-clock spacing deviates from 'period'.
+//---------------------------------------------------------------------------------------
+class RealtimeLagMonitor
+{
+public:
+  RealtimeLagMonitor (Time period, Time lagLimit)
+    : m_period (period),
+      m_lagLimit (lagLimit),
+      m_started (false),
+      m_samples (0),
+      m_behind (0),
+      m_lagSum (0),
+      m_lagMax (0),
+      m_jitterSum (0),
+      m_jitterSqSum (0),
+      m_jitterMax (0),
+      m_lastWall (0),
+      m_wallOffset (0)
+  {
+  }
+
+  void Start (Time at)
+  {
+    Simulator::Schedule (at, &RealtimeLagMonitor::Sample, this);
+  }
+
+  //---------------------------------------------------------------------------------------
+  //-- Print the stats and append them to a csv file, one line per run
+  //---------------------------------------------------------------------------------------
+  void Report (std::string filename, uint32_t numCarNodes) const
+  {
+    if (m_samples == 0)
+      {
+        return;
+      }
+    double lagMean = m_lagSum / m_samples;
+    double jitterMean = m_jitterSum / m_samples;
+    double jitterStd = std::sqrt (std::max (0.0, m_jitterSqSum / m_samples - jitterMean * jitterMean));
+    double behind = (double)m_behind / m_samples;
+
+    std::cout << "Real-time lag: samples " << m_samples
+              << ", mean lag " << lagMean / 1e6 << " ms, max lag " << m_lagMax / 1e6 << " ms"
+              << ", mean jitter " << jitterMean / 1e6 << " ms (std " << jitterStd / 1e6 << " ms)"
+              << ", max jitter " << m_jitterMax / 1e6 << " ms"
+              << ", behind > " << m_lagLimit.GetMilliSeconds () << " ms: " << behind * 100 << " %\n";
+
+    std::ofstream datafile (filename.c_str (), std::ios_base::app);
+    if (datafile.is_open ())
+      {
+        datafile << numCarNodes << ", " << m_samples << ", " << lagMean << ", " << m_lagMax << ", "
+                 << jitterMean << ", " << jitterStd << ", " << m_jitterMax << ", " << behind << "\n";
+      }
+  }
+
+private:
+  static int64_t WallNow (void)
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds> (
+      std::chrono::steady_clock::now ().time_since_epoch ()).count ();
+  }
+
+  void Sample (void)
+  {
+    int64_t wall = WallNow ();
+    int64_t sim = Simulator::Now ().GetNanoSeconds ();
+    if (!m_started)
+      {
+        m_wallOffset = wall - sim;
+        m_started = true;
+      }
+    else
+      {
+        double lag = (double)(wall - m_wallOffset - sim);
+        double jitter = std::abs ((double)(wall - m_lastWall) - m_period.GetNanoSeconds ());
+        ++m_samples;
+        m_lagSum += lag;
+        m_lagMax = std::max (m_lagMax, lag);
+        m_jitterSum += jitter;
+        m_jitterSqSum += jitter * jitter;
+        m_jitterMax = std::max (m_jitterMax, jitter);
+        if (lag > m_lagLimit.GetNanoSeconds ())
+          {
+            ++m_behind;
+          }
+      }
+    m_lastWall = wall;
+    Simulator::Schedule (m_period, &RealtimeLagMonitor::Sample, this);
+  }
+
+  Time m_period;
+  Time m_lagLimit;
+  bool m_started;
+  uint64_t m_samples;
+  uint64_t m_behind;
+  double m_lagSum;
+  double m_lagMax;
+  double m_jitterSum;
+  double m_jitterSqSum;
+  double m_jitterMax;
+  int64_t m_lastWall;
+  int64_t m_wallOffset;
+};
+
+} // namespace ns3
+
+#endif /* JUNCTION_EMU_BRIDGE_H */
@@ -0,0 +1,386 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef JUNCTION_PCAP_RING_H
+#define JUNCTION_PCAP_RING_H
+
+//---------------------------------------------------------------------------------------
+//-- Triggered pcap capture for the 802.11p devices. Instead of writing every frame to
+//-- disk, each selected device keeps its most recent frames in a fixed-size ring buffer.
+//-- Nothing is written until Trigger () is called (e.g. on a delay spike or a missed
+//-- sequence number); the rings are then dumped a short time later so the pcap holds
+//-- the frames leading up to, and just after, the event.
+//---------------------------------------------------------------------------------------
+
+#include <cstdlib>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "ns3/core-module.h"
+#include "ns3/network-module.h"
+#include "ns3/trace-helper.h"
+#include "ns3/wifi-net-device.h"
+#include "ns3/wifi-phy.h"
+#include "ns3/wifi-mac-header.h"
+
+#include "junction-scenario.h"
+
+namespace ns3 {
+
+class PcapRingCapture
+{
+public:
+  //---------------------------------------------------------------------------------------
+  //-- Frame type filter, may be OR'd together
+  //---------------------------------------------------------------------------------------
+  enum FrameType
+  {
+    FRAME_DATA = 1,
+    FRAME_MGMT = 2,
+    FRAME_CTL = 4,
+    FRAME_ALL = FRAME_DATA | FRAME_MGMT | FRAME_CTL
+  };
+
+  PcapRingCapture (std::string prefix, uint32_t ringSize)
+    : m_prefix (prefix),
+      m_ringSize (ringSize),
+      m_frameTypes (FRAME_ALL),
+      m_start (Seconds (0)),
+      m_stop (Time::Max ()),
+      m_postTrigger (MilliSeconds (100)),
+      m_maxDumps (10),
+      m_dumps (0),
+      m_dumpPending (false)
+  {
+  }
+
+  //---------------------------------------------------------------------------------------
+  //-- Restrict capture to the given node IDs, e.g. "0,2,5". Empty string = all nodes
+  //---------------------------------------------------------------------------------------
+  void SetNodeFilter (std::string nodeList)
+  {
+    m_nodes.clear ();
+    std::istringstream ss (nodeList);
+    std::string item;
+    while (std::getline (ss, item, ','))
+      {
+        if (!item.empty ())
+          {
+            m_nodes.insert (std::atoi (item.c_str ()));
+          }
+      }
+  }
+
+  //---------------------------------------------------------------------------------------
+  //-- Restrict capture to the given frame types, e.g. "data", "data,mgmt" or "all"
+  //---------------------------------------------------------------------------------------
+  void SetFrameFilter (std::string frameList)
+  {
+    m_frameTypes = 0;
+    std::istringstream ss (frameList);
+    std::string item;
+    while (std::getline (ss, item, ','))
+      {
+        if (item == "data")
+          {
+            m_frameTypes |= FRAME_DATA;
+          }
+        else if (item == "mgmt")
+          {
+            m_frameTypes |= FRAME_MGMT;
+          }
+        else if (item == "ctl")
+          {
+            m_frameTypes |= FRAME_CTL;
+          }
+        else if (item == "all")
+          {
+            m_frameTypes |= FRAME_ALL;
+          }
+        else
+          {
+            NS_FATAL_ERROR ("Unknown pcap frame type: " << item);
+          }
+      }
+  }
+
+  //---------------------------------------------------------------------------------------
+  //-- Only frames seen inside [start, stop] are buffered
+  //---------------------------------------------------------------------------------------
+  void SetTimeWindow (Time start, Time stop)
+  {
+    m_start = start;
+    m_stop = stop;
+  }
+
+  //---------------------------------------------------------------------------------------
+  //-- How long to keep recording after a trigger before the rings are written out, and
+  //-- the maximum number of dumps per run (bounds the disk I/O of a noisy trigger)
+  //---------------------------------------------------------------------------------------
+  void SetDumpPolicy (Time postTrigger, uint32_t maxDumps)
+  {
+    m_postTrigger = postTrigger;
+    m_maxDumps = maxDumps;
+  }
+
+  //---------------------------------------------------------------------------------------
+  //-- Hook the PHY sniffers of every Wi-Fi device whose node passes the node filter
+  //---------------------------------------------------------------------------------------
+  void Install (NetDeviceContainer devices)
+  {
+    for (NetDeviceContainer::Iterator i = devices.Begin (); i != devices.End (); ++i)
+      {
+        Ptr<WifiNetDevice> device = DynamicCast<WifiNetDevice> (*i);
+        if (device == 0)
+          {
+            continue;
+          }
+        uint32_t nodeId = device->GetNode ()->GetId ();
+        if (!m_nodes.empty () && m_nodes.find (nodeId) == m_nodes.end ())
+          {
+            continue;
+          }
+        Ptr<DeviceRing> ring = Create<DeviceRing> (this, nodeId, device->GetIfIndex (), m_ringSize);
+        Ptr<WifiPhy> phy = device->GetPhy ();
+        phy->TraceConnectWithoutContext ("MonitorSnifferTx", MakeCallback (&DeviceRing::SniffTx, ring));
+        phy->TraceConnectWithoutContext ("MonitorSnifferRx", MakeCallback (&DeviceRing::SniffRx, ring));
+        m_rings.push_back (ring);
+      }
+  }
+
+  //---------------------------------------------------------------------------------------
+  //-- Request a dump of all rings. Triggers arriving while a dump is pending are folded
+  //-- into that dump.
+  //---------------------------------------------------------------------------------------
+  void Trigger (std::string reason)
+  {
+    if (m_dumpPending || m_dumps >= m_maxDumps || m_rings.empty ())
+      {
+        return;
+      }
+    m_dumpPending = true;
+
+    std::ofstream index ((m_prefix + "-triggers.txt").c_str (), std::ios_base::app);
+    if (index.is_open ())
+      {
+        index << m_dumps << ", " << Simulator::Now ().GetNanoSeconds () << ", " << reason << "\n";
+      }
+    m_dumpEvent = Simulator::Schedule (m_postTrigger, &PcapRingCapture::Dump, this);
+  }
+
+  //---------------------------------------------------------------------------------------
+  //-- Write out a dump that is still waiting for its post-trigger time. Call after
+  //-- Simulator::Run (), otherwise a trigger close to the stop time is lost.
+  //---------------------------------------------------------------------------------------
+  void Flush (void)
+  {
+    if (m_dumpPending)
+      {
+        m_dumpEvent.Cancel ();
+        Dump ();
+      }
+  }
+
+private:
+  //---------------------------------------------------------------------------------------
+  //-- Fixed-size ring of the most recent frames seen by one device
+  //---------------------------------------------------------------------------------------
+  class DeviceRing : public SimpleRefCount<DeviceRing>
+  {
+  public:
+    struct Entry
+    {
+      Time time;
+      Ptr<const Packet> packet;
+    };
+
+    DeviceRing (PcapRingCapture *owner, uint32_t nodeId, uint32_t ifIndex, uint32_t size)
+      : m_owner (owner),
+        m_nodeId (nodeId),
+        m_ifIndex (ifIndex),
+        m_entries (size),
+        m_head (0),
+        m_count (0)
+    {
+    }
+
+    void SniffTx (Ptr<const Packet> packet, uint16_t channelFreqMhz,
+                  WifiTxVector txVector, MpduInfo aMpdu)
+    {
+      Record (packet);
+    }
+
+    void SniffRx (Ptr<const Packet> packet, uint16_t channelFreqMhz,
+                  WifiTxVector txVector, MpduInfo aMpdu, SignalNoiseDbm signalNoise)
+    {
+      Record (packet);
+    }
+
+    void Record (Ptr<const Packet> packet)
+    {
+      if (m_entries.empty () || !m_owner->Accept (packet))
+        {
+          return;
+        }
+      m_entries[m_head].time = Simulator::Now ();
+      m_entries[m_head].packet = packet;
+      m_head = (m_head + 1) % m_entries.size ();
+      if (m_count < m_entries.size ())
+        {
+          ++m_count;
+        }
+    }
+
+    void Write (std::string filename)
+    {
+      if (m_count == 0)
+        {
+          return;
+        }
+      PcapHelper pcapHelper;
+      Ptr<PcapFileWrapper> file = pcapHelper.CreateFile (filename, std::ios::out, PcapHelper::DLT_IEEE802_11);
+      uint32_t first = (m_head + m_entries.size () - m_count) % m_entries.size ();
+      for (uint32_t n = 0; n < m_count; ++n)
+        {
+          Entry &entry = m_entries[(first + n) % m_entries.size ()];
+          file->Write (entry.time, entry.packet);
+          entry.packet = 0;
+        }
+      m_count = 0;
+    }
+
+    PcapRingCapture *m_owner;
+    uint32_t m_nodeId;
+    uint32_t m_ifIndex;
+    std::vector<Entry> m_entries;
+    uint32_t m_head;
+    uint32_t m_count;
+  };
+
+  //---------------------------------------------------------------------------------------
+  //-- Time window and frame type filter, applied before a frame enters a ring
+  //---------------------------------------------------------------------------------------
+  bool Accept (Ptr<const Packet> packet) const
+  {
+    Time now = Simulator::Now ();
+    if (now < m_start || now > m_stop)
+      {
+        return false;
+      }
+    if (m_frameTypes == FRAME_ALL)
+      {
+        return true;
+      }
+    WifiMacHeader hdr;
+    packet->PeekHeader (hdr);
+    if (hdr.IsData ())
+      {
+        return m_frameTypes & FRAME_DATA;
+      }
+    if (hdr.IsMgt ())
+      {
+        return m_frameTypes & FRAME_MGMT;
+      }
+    return m_frameTypes & FRAME_CTL;
+  }
+
+  //---------------------------------------------------------------------------------------
+  //-- Write every ring to <prefix>-<dump>-<node>-<device>.pcap and empty it
+  //---------------------------------------------------------------------------------------
+  void Dump (void)
+  {
+    for (std::vector<Ptr<DeviceRing> >::iterator i = m_rings.begin (); i != m_rings.end (); ++i)
+      {
+        std::ostringstream filename;
+        filename << m_prefix << "-" << m_dumps << "-" << (*i)->m_nodeId << "-" << (*i)->m_ifIndex << ".pcap";
+        (*i)->Write (filename.str ());
+      }
+    ++m_dumps;
+    m_dumpPending = false;
+  }
+
+  std::string m_prefix;
+  uint32_t m_ringSize;
+  uint32_t m_frameTypes;
+  std::set<uint32_t> m_nodes;
+  Time m_start;
+  Time m_stop;
+  Time m_postTrigger;
+  uint32_t m_maxDumps;
+  uint32_t m_dumps;
+  bool m_dumpPending;
+  EventId m_dumpEvent;
+  std::vector<Ptr<DeviceRing> > m_rings;
+};
+
+//---------------------------------------------------------------------------------------
+//-- Measure policy (see junction-scenario.h) that fires the capture's trigger on a delay
+//-- above 'delayThreshold' (0 = off) or, if 'onSeqGap', on a missed sequence number.
+//-- With no capture attached it does nothing.
+//---------------------------------------------------------------------------------------
+class PcapTriggerSink
+{
+public:
+  static const bool NeedsDistance = false;
+
+  PcapTriggerSink (PcapRingCapture *capture, Time delayThreshold, bool onSeqGap)
+    : m_capture (capture),
+      m_delayThreshold (delayThreshold.GetNanoSeconds ()),
+      m_onSeqGap (onSeqGap),
+      m_expectedSeq (0)
+  {
+  }
+
+  void OnReceive (const RxSample &s)
+  {
+    if (m_capture)
+      {
+        if (m_delayThreshold > 0 && s.delay > m_delayThreshold)
+          {
+            std::ostringstream reason;
+            reason << "delay " << s.delay << " ns, seq " << s.seq;
+            m_capture->Trigger (reason.str ());
+          }
+        if (m_onSeqGap && s.seq > m_expectedSeq)
+          {
+            std::ostringstream reason;
+            reason << "seq gap, expected " << m_expectedSeq << " got " << s.seq;
+            m_capture->Trigger (reason.str ());
+          }
+      }
+    if (s.seq >= m_expectedSeq)
+      {
+        m_expectedSeq = s.seq + 1;
+      }
+  }
+
+  void OnTrafficDone (uint32_t totalData)
+  {
+  }
+
+private:
+  PcapRingCapture *m_capture;
+  int64_t m_delayThreshold;
+  bool m_onSeqGap;
+  uint32_t m_expectedSeq;
+};
+
+} // namespace ns3
+
+#endif /* JUNCTION_PCAP_RING_H */
@@ -0,0 +1,363 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef JUNCTION_PROGRESS_H
+#define JUNCTION_PROGRESS_H
+
+//---------------------------------------------------------------------------------------
+//-- Opt-in progress telemetry for long runs. Every 'interval' of wall-clock time one line
+//-- of key=value pairs is written, e.g.
+//--
+//--   sim=12.000 wall=3.210 ratio=3.738 sampleAge=0.004 events=123456 eventRate=40123
+//--   scheduledMinusExecuted=12 rssKb=20480 sent=120 received=118 eta=45.2
+//--
+//-- (on a single line) to a stats file, to a Unix datagram socket, or to stderr if
+//-- neither is set. The simulation values are recorded every 'sample' of simulated time
+//-- and written by a watchdog thread, so lines keep coming at the same wall-clock rate
+//-- however slow the run is. 'sampleAge' is the wall-clock seconds since the last
+//-- sample: a run that stops advancing (e.g. a storm of same-timestamp events) keeps
+//-- writing the same 'sim' with a growing 'sampleAge', and a file or socket that goes
+//-- quiet for a few intervals means the process itself has hung or died. 'ratio' is
+//-- simulated seconds per wall-clock second and 'eta' the wall-clock seconds left until
+//-- the stop time at the average ratio so far. A last line with 'done=1' is written
+//-- when the simulator is destroyed.
+//--
+//-- 'scheduledMinusExecuted' is only a rough upper bound on the event queue length. It is
+//-- derived from event uids, which is an implementation detail of the default simulator:
+//-- cancelled and removed events and those from ScheduleDestroy () are still counted, so
+//-- it can grow over a run while the real queue stays the same size. Use it to spot
+//-- runaway scheduling, not as an exact count.
+//--
+//-- A scenario only needs AddCommandLineOptions () before parsing and Start () before
+//-- Simulator::Run (); reporting stays off unless --progress is given.
+//---------------------------------------------------------------------------------------
+
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "ns3/core-module.h"
+
+namespace ns3 {
+
+class ProgressReporter
+{
+public:
+  ProgressReporter ()
+    : m_interval (0),
+      m_sampleInterval (0.1),
+      m_fd (-1),
+      m_scheduled (0),
+      m_running (false),
+      m_wallStart (0),
+      m_lastWall (0),
+      m_lastEvents (0)
+  {
+  }
+
+  ~ProgressReporter ()
+  {
+    Stop ();
+    if (m_fd >= 0)
+      {
+        ::close (m_fd);
+      }
+  }
+
+  //---------------------------------------------------------------------------------------
+  //-- Adds --progress, --progressSample, --progressFile and --progressSocket
+  //---------------------------------------------------------------------------------------
+  void AddCommandLineOptions (CommandLine &cmd)
+  {
+    cmd.AddValue ("progress", "Progress report interval in wall-clock seconds, 0 = off", m_interval);
+    cmd.AddValue ("progressSample", "Progress sampling interval in simulated seconds", m_sampleInterval);
+    cmd.AddValue ("progressFile", "Append progress lines to this file", m_filename);
+    cmd.AddValue ("progressSocket", "Send progress lines to this Unix datagram socket", m_socketPath);
+  }
+
+  //---------------------------------------------------------------------------------------
+  //-- Start reporting if --progress was given. 'stopTime' is used for the ETA, 'sent'
+  //-- and 'received' give the packet counts so far.
+  //---------------------------------------------------------------------------------------
+  void Start (Time stopTime, Callback<uint64_t> sent, Callback<uint64_t> received)
+  {
+    if (m_interval <= 0)
+      {
+        return;
+      }
+    NS_ABORT_MSG_IF (m_sampleInterval <= 0, "ProgressReporter: --progressSample must be positive");
+    if (!m_filename.empty ())
+      {
+        OpenFile (m_filename);
+      }
+    if (!m_socketPath.empty ())
+      {
+        OpenUnixSocket (m_socketPath);
+      }
+    m_stopTime = stopTime;
+    m_sent = sent;
+    m_received = received;
+    m_wallStart = WallNow ();
+    m_lastWall = m_wallStart;
+    m_lastEvents = Simulator::GetEventCount ();
+    m_scheduled = Simulator::Schedule (Seconds (m_sampleInterval), &ProgressReporter::Sample, this).GetUid ();
+    Record (m_scheduled);
+    Simulator::ScheduleDestroy (&ProgressReporter::Finish, this);
+
+    m_running = true;
+    m_watchdog = std::thread (&ProgressReporter::Watchdog, this);
+  }
+
+private:
+  //---------------------------------------------------------------------------------------
+  //-- Simulation values as of the last sample, shared with the watchdog thread
+  //---------------------------------------------------------------------------------------
+  struct Values
+  {
+    double sim;
+    int64_t wall;
+    uint64_t events;
+    uint64_t scheduledMinusExecuted;
+    uint64_t sent;
+    uint64_t received;
+  };
+
+  //---------------------------------------------------------------------------------------
+  //-- Append the lines to a file, flushed after every line
+  //---------------------------------------------------------------------------------------
+  void OpenFile (std::string filename)
+  {
+    m_file.open (filename.c_str (), std::ios_base::app);
+    NS_ABORT_MSG_IF (!m_file.is_open (), "ProgressReporter: cannot open " << filename);
+  }
+
+  //---------------------------------------------------------------------------------------
+  //-- Send each line as one datagram to the Unix socket at 'path'. Lines are dropped
+  //-- while nobody is listening.
+  //---------------------------------------------------------------------------------------
+  void OpenUnixSocket (std::string path)
+  {
+    NS_ABORT_MSG_IF (path.size () >= sizeof (m_addr.sun_path), "ProgressReporter: socket path too long");
+    m_fd = ::socket (AF_UNIX, SOCK_DGRAM, 0);
+    NS_ABORT_MSG_IF (m_fd < 0, "ProgressReporter: socket() failed: " << std::strerror (errno));
+    std::memset (&m_addr, 0, sizeof (m_addr));
+    m_addr.sun_family = AF_UNIX;
+    std::strncpy (m_addr.sun_path, path.c_str (), sizeof (m_addr.sun_path) - 1);
+  }
+
+  static int64_t WallNow (void)
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds> (
+      std::chrono::steady_clock::now ().time_since_epoch ()).count ();
+  }
+
+  //---------------------------------------------------------------------------------------
+  //-- Resident set size in kB, from /proc on Linux or the peak from getrusage otherwise
+  //---------------------------------------------------------------------------------------
+  static uint64_t RssKb (void)
+  {
+    std::ifstream statm ("/proc/self/statm");
+    uint64_t size = 0;
+    uint64_t resident = 0;
+    if (statm >> size >> resident)
+      {
+        return resident * (uint64_t)sysconf (_SC_PAGESIZE) / 1024;
+      }
+    struct rusage usage;
+    getrusage (RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+  }
+
+  //---------------------------------------------------------------------------------------
+  //-- Simulation thread: store the current values for the watchdog
+  //---------------------------------------------------------------------------------------
+  void Record (uint64_t scheduled)
+  {
+    Values v;
+    v.sim = Simulator::Now ().GetSeconds ();
+    v.wall = WallNow ();
+    v.events = Simulator::GetEventCount ();
+    v.scheduledMinusExecuted = scheduled > v.events ? scheduled - v.events : 0;
+    v.sent = m_sent.IsNull () ? 0 : m_sent ();
+    v.received = m_received.IsNull () ? 0 : m_received ();
+
+    std::lock_guard<std::mutex> lock (m_mutex);
+    m_values = v;
+  }
+
+  void Sample (void)
+  {
+    //---------------------------------------------------------------------------------------
+    //-- Reschedule first, the new event's uid is roughly how many events have ever been
+    //-- scheduled (see the note at the top of the file, this is not an exact count)
+    //---------------------------------------------------------------------------------------
+    EventId next = Simulator::Schedule (Seconds (m_sampleInterval), &ProgressReporter::Sample, this);
+    m_scheduled = next.GetUid ();
+    Record (m_scheduled);
+  }
+
+  //---------------------------------------------------------------------------------------
+  //-- Called from Simulator::Destroy (): take a last sample and write the final line
+  //---------------------------------------------------------------------------------------
+  void Finish (void)
+  {
+    Record (m_scheduled);
+    Stop ();
+  }
+
+  void Stop (void)
+  {
+    if (!m_watchdog.joinable ())
+      {
+        return;
+      }
+    {
+      std::lock_guard<std::mutex> lock (m_mutex);
+      m_running = false;
+    }
+    m_wake.notify_all ();
+    m_watchdog.join ();
+    Report (true);
+  }
+
+  //---------------------------------------------------------------------------------------
+  //-- Watchdog thread: one line every 'interval' of wall-clock time until stopped
+  //---------------------------------------------------------------------------------------
+  void Watchdog (void)
+  {
+    std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now ();
+    std::chrono::steady_clock::duration period =
+      std::chrono::duration_cast<std::chrono::steady_clock::duration> (std::chrono::duration<double> (m_interval));
+    std::unique_lock<std::mutex> lock (m_mutex);
+    while (true)
+      {
+        next += period;
+        if (m_wake.wait_until (lock, next, [this] { return !m_running; }))
+          {
+            return;
+          }
+        lock.unlock ();
+        Report (false);
+        lock.lock ();
+      }
+  }
+
+  void Report (bool done)
+  {
+    Values v;
+    {
+      std::lock_guard<std::mutex> lock (m_mutex);
+      v = m_values;
+    }
+
+    int64_t wall = WallNow ();
+    double wallElapsed = (wall - m_wallStart) / 1e9;
+    double sampleAge = (wall - v.wall) / 1e9;
+    double ratio = wallElapsed > 0 ? v.sim / wallElapsed : 0;
+    double dt = (wall - m_lastWall) / 1e9;
+    double eventRate = dt > 0 ? (v.events - m_lastEvents) / dt : 0;
+    m_lastWall = wall;
+    m_lastEvents = v.events;
+
+    std::ostringstream line;
+    line.setf (std::ios::fixed);
+    line.precision (3);
+    line << "sim=" << v.sim << " wall=" << wallElapsed << " ratio=" << ratio
+         << " sampleAge=" << sampleAge;
+    line.precision (0);
+    line << " events=" << v.events << " eventRate=" << eventRate
+         << " scheduledMinusExecuted=" << v.scheduledMinusExecuted << " rssKb=" << RssKb ();
+    if (!m_sent.IsNull ())
+      {
+        line << " sent=" << v.sent;
+      }
+    if (!m_received.IsNull ())
+      {
+        line << " received=" << v.received;
+      }
+    if (done)
+      {
+        line << " done=1";
+      }
+    else if (ratio > 0)
+      {
+        line.precision (1);
+        line << " eta=" << (m_stopTime.GetSeconds () - v.sim) / ratio;
+      }
+    line << "\n";
+
+    Write (line.str ());
+  }
+
+  //---------------------------------------------------------------------------------------
+  //-- Only called from the watchdog thread, or after it has been joined
+  //---------------------------------------------------------------------------------------
+  void Write (const std::string &line)
+  {
+    if (m_fd >= 0)
+      {
+        ::sendto (m_fd, line.data (), line.size (), MSG_DONTWAIT,
+                  (struct sockaddr *)&m_addr, sizeof (m_addr));
+      }
+    if (m_file.is_open ())
+      {
+        m_file << line;
+        m_file.flush ();
+      }
+    if (m_fd < 0 && !m_file.is_open ())
+      {
+        std::cerr << line;
+      }
+  }
+
+  double m_interval; // wall-clock seconds, 0 = off
+  double m_sampleInterval; // simulated seconds
+  std::string m_filename;
+  std::string m_socketPath;
+  Time m_stopTime;
+  std::ofstream m_file;
+  int m_fd;
+  struct sockaddr_un m_addr;
+  Callback<uint64_t> m_sent;
+  Callback<uint64_t> m_received;
+  uint64_t m_scheduled; // uid of the last Sample event, simulation thread only
+
+  std::thread m_watchdog;
+  std::mutex m_mutex;
+  std::condition_variable m_wake;
+  bool m_running; // guarded by m_mutex
+  Values m_values; // guarded by m_mutex
+  int64_t m_wallStart;
+  int64_t m_lastWall; // watchdog only
+  uint64_t m_lastEvents; // watchdog only
+};
+
+} // namespace ns3
+
+#endif /* JUNCTION_PROGRESS_H */
@@ -0,0 +1,597 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef JUNCTION_SCENARIO_H
+#define JUNCTION_SCENARIO_H
+
+//---------------------------------------------------------------------------------------
+//-- Shared building blocks for the junction scenarios: the 802.11p device/stack setup,
+//-- the traffic generator and the receiver.
+//--
+//-- What the receiver measures is chosen at compile time through a Measure policy, so a
+//-- binary only pays for the measurements it uses. A policy provides:
+//--
+//--   static const bool NeedsDistance;      // false skips the mobility lookup per packet
+//--   void OnReceive (const RxSample &s);   // called for every packet received
+//--   void OnTrafficDone (uint32_t data);   // called once the generator has finished
+//--
+//-- Policies are combined with SinkPair<A, B>.
+//--
+//-- Traffic runs either over UDP broadcast (TRAFFIC_IP, needs the internet stack) or
+//-- straight over the OCB devices (TRAFFIC_WSMP), with no IP, UDP or ARP in the path and
+//-- no internet stack installed on the nodes.
+//---------------------------------------------------------------------------------------
+
+#include <fstream>
+#include <map>
+#include <string>
+
+#include "ns3/core-module.h"
+#include "ns3/network-module.h"
+#include "ns3/mobility-module.h"
+#include "ns3/internet-module.h"
+#include "ns3/yans-wifi-helper.h"
+#include "ns3/seq-ts-header.h"
+#include "ns3/ocb-wifi-mac.h"
+#include "ns3/wifi-80211p-helper.h"
+#include "ns3/wave-mac-helper.h"
+
+namespace ns3 {
+
+enum TrafficMode
+{
+  TRAFFIC_IP,
+  TRAFFIC_WSMP
+};
+
+//---------------------------------------------------------------------------------------
+//-- EtherType carried in the LLC/SNAP header of raw OCB frames (IEEE 1609.3 WSMP)
+//---------------------------------------------------------------------------------------
+static const uint16_t WSMP_PROTOCOL = 0x88DC;
+
+//---------------------------------------------------------------------------------------
+//-- EtherType for background beacons (IEEE 802 local experimental), kept apart from
+//-- WSMP_PROTOCOL so the measured receiver never sees them
+//---------------------------------------------------------------------------------------
+static const uint16_t BEACON_PROTOCOL = 0x88B5;
+
+//---------------------------------------------------------------------------------------
+//-- Parses the --traffic command line value, "ip" or "wsmp"
+//---------------------------------------------------------------------------------------
+inline TrafficMode
+ParseTrafficMode (std::string mode)
+{
+  if (mode == "ip")
+    {
+      return TRAFFIC_IP;
+    }
+  if (mode == "wsmp")
+    {
+      return TRAFFIC_WSMP;
+    }
+  NS_FATAL_ERROR ("Unknown traffic mode: " << mode << " (expected ip or wsmp)");
+  return TRAFFIC_IP;
+}
+
+//---------------------------------------------------------------------------------------
+//-- Calculates and returns the straight line distance (m) between two nodes and
+//-- returns as a double
+//---------------------------------------------------------------------------------------
+inline double
+CalcNodeDistance (Ptr<Node> node1, Ptr<Node> node2)
+{
+  Ptr<MobilityModel> model1 = node1->GetObject<MobilityModel>();
+  Ptr<MobilityModel> model2 = node2->GetObject<MobilityModel>();
+  double distance = model1->GetDistanceFrom (model2);
+  return distance;
+}
+
+//---------------------------------------------------------------------------------------
+//-- What the receiver knows about one received packet
+//---------------------------------------------------------------------------------------
+struct RxSample
+{
+  int64_t now;      // ns
+  int64_t delay;    // ns
+  uint32_t seq;
+  uint32_t size;    // bytes, payload without the SeqTsHeader
+  double distance;  // m, only filled in if the policy NeedsDistance
+};
+
+//---------------------------------------------------------------------------------------
+//-- Measure policy: total delay only, written once per run as "totalData, totalDelay"
+//---------------------------------------------------------------------------------------
+class TotalsSink
+{
+public:
+  static const bool NeedsDistance = false;
+
+  TotalsSink (std::string filename)
+    : m_filename (filename),
+      m_totalDelay (0)
+  {
+  }
+
+  void OnReceive (const RxSample &s)
+  {
+    m_totalDelay += s.delay;
+  }
+
+  void OnTrafficDone (uint32_t totalData)
+  {
+    std::ofstream datafile (m_filename.c_str (), std::ios_base::app);
+    if (datafile.is_open())
+      {
+        datafile << totalData << ", " << m_totalDelay << "\n";
+      }
+  }
+
+private:
+  std::string m_filename;
+  int64_t m_totalDelay;
+};
+
+//---------------------------------------------------------------------------------------
+//-- Measure policy: one line per packet, "count, time, delay, distance, size"
+//---------------------------------------------------------------------------------------
+class PacketTraceSink
+{
+public:
+  static const bool NeedsDistance = true;
+
+  PacketTraceSink (std::string filename)
+    : m_datafile (filename.c_str (), std::ios_base::app),
+      m_packetCount (1)
+  {
+  }
+
+  void OnReceive (const RxSample &s)
+  {
+    if (m_datafile.is_open())
+      {
+        m_datafile << m_packetCount << ", " << s.now << ", " << s.delay << ", " << s.distance << ", " << s.size << "\n";
+      }
+    ++m_packetCount;
+  }
+
+  void OnTrafficDone (uint32_t totalData)
+  {
+    m_datafile.flush ();
+  }
+
+private:
+  std::ofstream m_datafile;
+  uint32_t m_packetCount;
+};
+
+//---------------------------------------------------------------------------------------
+//-- Measure policy: packet count and mean delay per distance bin, written at the end
+//-- as "binStart, count, meanDelay"
+//---------------------------------------------------------------------------------------
+class DistanceBinSink
+{
+public:
+  static const bool NeedsDistance = true;
+
+  DistanceBinSink (std::string filename, double binWidth)
+    : m_filename (filename),
+      m_binWidth (binWidth)
+  {
+    NS_ABORT_MSG_IF (binWidth <= 0, "DistanceBinSink: bin width must be > 0, got " << binWidth);
+  }
+
+  void OnReceive (const RxSample &s)
+  {
+    Bin &bin = m_bins[(uint32_t)(s.distance / m_binWidth)];
+    ++bin.count;
+    bin.delay += s.delay;
+  }
+
+  void OnTrafficDone (uint32_t totalData)
+  {
+    std::ofstream datafile (m_filename.c_str (), std::ios_base::app);
+    if (!datafile.is_open())
+      {
+        return;
+      }
+    for (std::map<uint32_t, Bin>::const_iterator i = m_bins.begin (); i != m_bins.end (); ++i)
+      {
+        datafile << i->first * m_binWidth << ", " << i->second.count << ", "
+                 << i->second.delay / i->second.count << "\n";
+      }
+  }
+
+private:
+  struct Bin
+  {
+    Bin () : count (0), delay (0) {}
+    uint32_t count;
+    int64_t delay;
+  };
+
+  std::string m_filename;
+  double m_binWidth;
+  std::map<uint32_t, Bin> m_bins;
+};
+
+//---------------------------------------------------------------------------------------
+//-- Combines two Measure policies. Nest for more, e.g. SinkPair<A, SinkPair<B, C> >
+//---------------------------------------------------------------------------------------
+template <class A, class B>
+class SinkPair
+{
+public:
+  static const bool NeedsDistance = A::NeedsDistance || B::NeedsDistance;
+
+  SinkPair (A &a, B &b)
+    : m_a (a),
+      m_b (b)
+  {
+  }
+
+  void OnReceive (const RxSample &s)
+  {
+    m_a.OnReceive (s);
+    m_b.OnReceive (s);
+  }
+
+  void OnTrafficDone (uint32_t totalData)
+  {
+    m_a.OnTrafficDone (totalData);
+    m_b.OnTrafficDone (totalData);
+  }
+
+private:
+  A &m_a;
+  B &m_b;
+};
+
+//---------------------------------------------------------------------------------------
+//-- Receives packets on one node and feeds each one to the Measure policy
+//---------------------------------------------------------------------------------------
+template <class Measure>
+class JunctionReceiver
+{
+public:
+  JunctionReceiver (Measure &measure, Ptr<Node> txNode, Ptr<Node> rxNode)
+    : m_measure (measure),
+      m_txNode (txNode),
+      m_rxNode (rxNode),
+      m_received (0),
+      m_echo (false)
+  {
+  }
+
+  //---------------------------------------------------------------------------------------
+  //-- Broadcast every received packet back on 'port' (used by the emulation mode)
+  //---------------------------------------------------------------------------------------
+  void EnableEcho (uint16_t port)
+  {
+    m_echo = true;
+    m_echoPort = port;
+  }
+
+  //---------------------------------------------------------------------------------------
+  //-- Socket receive callback (TRAFFIC_IP)
+  //---------------------------------------------------------------------------------------
+  void Receive (Ptr<Socket> socket)
+  {
+    Ptr<Packet> packet;
+    while ((packet = socket->Recv ()))
+      {
+        SeqTsHeader seqTs;
+        packet->RemoveHeader (seqTs);
+        Handle (packet->GetSize (), seqTs);
+
+        if (m_echo)
+          {
+            packet->AddHeader (seqTs);
+            socket->SendTo (packet, 0, InetSocketAddress (Ipv4Address ("255.255.255.255"), m_echoPort));
+          }
+      }
+  }
+
+  //---------------------------------------------------------------------------------------
+  //-- Protocol handler for raw OCB frames (TRAFFIC_WSMP). The header is only peeked,
+  //-- so the packet is not copied unless it is echoed.
+  //---------------------------------------------------------------------------------------
+  void ReceiveFromDevice (Ptr<NetDevice> device, Ptr<const Packet> packet, uint16_t protocol,
+                          const Address &from, const Address &to, NetDevice::PacketType packetType)
+  {
+    SeqTsHeader seqTs;
+    uint32_t headerSize = packet->PeekHeader (seqTs);
+    Handle (packet->GetSize () - headerSize, seqTs);
+
+    if (m_echo)
+      {
+        device->Send (packet->Copy (), device->GetBroadcast (), protocol);
+      }
+  }
+
+  uint64_t GetReceived (void) const
+  {
+    return m_received;
+  }
+
+private:
+  void Handle (uint32_t size, const SeqTsHeader &seqTs)
+  {
+    RxSample s;
+    s.now = Simulator::Now ().GetNanoSeconds ();
+    s.delay = s.now - seqTs.GetTs ().GetNanoSeconds ();
+    s.seq = seqTs.GetSeq ();
+    s.size = size;
+    s.distance = Measure::NeedsDistance ? CalcNodeDistance (m_txNode, m_rxNode) : 0;
+    ++m_received;
+    m_measure.OnReceive (s);
+  }
+
+  Measure &m_measure;
+  Ptr<Node> m_txNode;
+  Ptr<Node> m_rxNode;
+  uint64_t m_received;
+  bool m_echo;
+  uint16_t m_echoPort;
+};
+
+//---------------------------------------------------------------------------------------
+//-- Sends totalData bytes in packets of at most maxPktSize, one every interval, either
+//-- on a socket or as raw OCB broadcasts on a device. When done the callback is invoked
+//-- with totalData and the socket, if any, is closed.
+//---------------------------------------------------------------------------------------
+class TrafficGenerator
+{
+public:
+  TrafficGenerator (uint32_t maxPktSize, Time interval)
+    : m_maxPktSize (maxPktSize),
+      m_interval (interval),
+      m_totalData (0),
+      m_seq (0),
+      m_protocol (WSMP_PROTOCOL)
+  {
+  }
+
+  void SetSocket (Ptr<Socket> socket)
+  {
+    m_socket = socket;
+    m_device = 0;
+  }
+
+  void SetDevice (Ptr<NetDevice> device, uint16_t protocol = WSMP_PROTOCOL)
+  {
+    m_device = device;
+    m_protocol = protocol;
+    m_socket = 0;
+  }
+
+  void SetDoneCallback (Callback<void, uint32_t> done)
+  {
+    m_done = done;
+  }
+
+  void Start (Time at, uint32_t totalData)
+  {
+    //---------------------------------------------------------------------------------------
+    //-- Calc number of packets needed, rounding up if there's a remainder
+    //---------------------------------------------------------------------------------------
+    uint32_t numPackets = totalData / m_maxPktSize;
+    if (totalData % m_maxPktSize != 0)
+      {
+        ++numPackets;
+      }
+    m_totalData = totalData;
+    Ptr<Node> node = m_socket ? m_socket->GetNode () : m_device->GetNode ();
+    Simulator::ScheduleWithContext (node->GetId (), at,
+                                    &TrafficGenerator::Send, this, numPackets, totalData);
+  }
+
+  uint64_t GetSent (void) const
+  {
+    return m_seq;
+  }
+
+private:
+  void Send (uint32_t pktCount, uint32_t dataLeft)
+  {
+    //---------------------------------------------------------------------------------------
+    //-- If packets left, send
+    //---------------------------------------------------------------------------------------
+    if (pktCount > 0)
+      {
+        uint32_t pktSize = dataLeft < m_maxPktSize ? dataLeft : m_maxPktSize;
+        Ptr<Packet> pkt = Create<Packet> (pktSize);
+        SeqTsHeader hdr = SeqTsHeader ();
+        hdr.SetSeq (m_seq++);
+        pkt->AddHeader (hdr);
+        if (m_socket)
+          {
+            m_socket->Send (pkt);
+          }
+        else
+          {
+            m_device->Send (pkt, m_device->GetBroadcast (), m_protocol);
+          }
+        Simulator::Schedule (m_interval, &TrafficGenerator::Send, this, pktCount - 1, dataLeft - pktSize);
+      }
+    //---------------------------------------------------------------------------------------
+    //-- If no packets left, report and close socket
+    //---------------------------------------------------------------------------------------
+    else
+      {
+        if (!m_done.IsNull ())
+          {
+            m_done (m_totalData);
+          }
+        if (m_socket)
+          {
+            m_socket->Close ();
+          }
+      }
+  }
+
+  Ptr<Socket> m_socket;
+  Ptr<NetDevice> m_device;
+  uint32_t m_maxPktSize;
+  Time m_interval;
+  uint32_t m_totalData;
+  uint32_t m_seq;
+  uint16_t m_protocol;
+  Callback<void, uint32_t> m_done;
+};
+
+//---------------------------------------------------------------------------------------
+//-- 802.11p (OCB) devices, internet stack and sockets for the junction nodes. All nodes
+//-- share one channel, and each node gets exactly one device.
+//---------------------------------------------------------------------------------------
+class JunctionScenario
+{
+public:
+  JunctionScenario (std::string phyMode, TrafficMode mode = TRAFFIC_IP)
+    : m_mode (mode),
+      m_phy (YansWifiPhyHelper::Default ()),
+      m_mac (NqosWaveMacHelper::Default ()),
+      m_wifi (Wifi80211pHelper::Default ())
+  {
+    YansWifiChannelHelper wifiChannel = YansWifiChannelHelper::Default ();
+    m_phy.SetChannel (wifiChannel.Create ());
+    m_phy.SetPcapDataLinkType (WifiPhyHelper::DLT_IEEE802_11);
+    m_wifi.SetRemoteStationManager ("ns3::ConstantRateWifiManager",
+                                    "DataMode",StringValue (phyMode),
+                                    "ControlMode",StringValue (phyMode));
+  }
+
+  NetDeviceContainer InstallDevices (NodeContainer nodes)
+  {
+    NetDeviceContainer devices = m_wifi.Install (m_phy, m_mac, nodes);
+    m_devices.Add (devices);
+    return devices;
+  }
+
+  //---------------------------------------------------------------------------------------
+  //-- Every device installed so far
+  //---------------------------------------------------------------------------------------
+  NetDeviceContainer GetDevices (void) const
+  {
+    return m_devices;
+  }
+
+  TrafficMode GetTrafficMode (void) const
+  {
+    return m_mode;
+  }
+
+  //---------------------------------------------------------------------------------------
+  //-- Install the internet stack on the devices' nodes and number them from 'base'.
+  //-- Does nothing for TRAFFIC_WSMP.
+  //---------------------------------------------------------------------------------------
+  Ipv4InterfaceContainer InstallInternet (NetDeviceContainer devices, std::string base)
+  {
+    if (m_mode == TRAFFIC_WSMP)
+      {
+        return Ipv4InterfaceContainer ();
+      }
+
+    NodeContainer nodes;
+    for (NetDeviceContainer::Iterator i = devices.Begin (); i != devices.End (); ++i)
+      {
+        nodes.Add ((*i)->GetNode ());
+      }
+    m_internet.Install (nodes);
+
+    Ipv4AddressHelper ipv4;
+    ipv4.SetBase (base.c_str (), "255.255.255.0");
+    return ipv4.Assign (devices);
+  }
+
+  Ptr<Socket> CreateSink (Ptr<Node> node, uint16_t port)
+  {
+    Ptr<Socket> sink = Socket::CreateSocket (node, UdpSocketFactory::GetTypeId ());
+    sink->Bind (InetSocketAddress (Ipv4Address::GetAny (), port));
+    return sink;
+  }
+
+  Ptr<Socket> CreateBroadcastSource (Ptr<Node> node, uint16_t port)
+  {
+    Ptr<Socket> source = Socket::CreateSocket (node, UdpSocketFactory::GetTypeId ());
+    source->SetAllowBroadcast (true);
+    source->Connect (InetSocketAddress (Ipv4Address ("255.255.255.255"), port));
+    return source;
+  }
+
+  //---------------------------------------------------------------------------------------
+  //-- Send the generator's traffic as broadcasts from 'device' on 'port'. For
+  //-- TRAFFIC_WSMP the frames go straight to the device and 'port' is unused.
+  //---------------------------------------------------------------------------------------
+  void ConnectSender (TrafficGenerator &traffic, Ptr<NetDevice> device, uint16_t port)
+  {
+    if (m_mode == TRAFFIC_WSMP)
+      {
+        traffic.SetDevice (device);
+      }
+    else
+      {
+        traffic.SetSocket (CreateBroadcastSource (device->GetNode (), port));
+      }
+  }
+
+  //---------------------------------------------------------------------------------------
+  //-- Like ConnectSender, for background traffic nobody measures: TRAFFIC_WSMP frames
+  //-- carry BEACON_PROTOCOL, so pick a 'port' no receiver is bound to for TRAFFIC_IP.
+  //---------------------------------------------------------------------------------------
+  void ConnectBeacon (TrafficGenerator &traffic, Ptr<NetDevice> device, uint16_t port)
+  {
+    if (m_mode == TRAFFIC_WSMP)
+      {
+        traffic.SetDevice (device, BEACON_PROTOCOL);
+      }
+    else
+      {
+        traffic.SetSocket (CreateBroadcastSource (device->GetNode (), port));
+      }
+  }
+
+  //---------------------------------------------------------------------------------------
+  //-- Deliver the traffic arriving at 'device' to 'receiver'. For TRAFFIC_WSMP the
+  //-- receiver is registered as the node's handler for WSMP_PROTOCOL frames.
+  //---------------------------------------------------------------------------------------
+  template <class Receiver>
+  void ConnectReceiver (Receiver &receiver, Ptr<NetDevice> device, uint16_t port)
+  {
+    if (m_mode == TRAFFIC_WSMP)
+      {
+        device->GetNode ()->RegisterProtocolHandler (MakeCallback (&Receiver::ReceiveFromDevice, &receiver),
+                                                     WSMP_PROTOCOL, device);
+      }
+    else
+      {
+        Ptr<Socket> sink = CreateSink (device->GetNode (), port);
+        sink->SetAllowBroadcast (true);
+        sink->SetRecvCallback (MakeCallback (&Receiver::Receive, &receiver));
+      }
+  }
+
+private:
+  TrafficMode m_mode;
+  YansWifiPhyHelper m_phy;
+  NqosWaveMacHelper m_mac;
+  Wifi80211pHelper m_wifi;
+  InternetStackHelper m_internet;
+  NetDeviceContainer m_devices;
+};
+
+} // namespace ns3
+
+#endif /* JUNCTION_SCENARIO_H */
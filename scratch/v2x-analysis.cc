@@ -17,6 +17,8 @@
 
 #include <iostream>
 #include <fstream>
+#include <cmath>
+#include <vector>
 
 using namespace std;
 
@@ -32,14 +34,13 @@ using namespace std;
 #include "ns3/netanim-module.h"
 
 #include "ns3/flow-monitor-module.h"
-#include "ns3/seq-ts-header.h"
-#include "ns3/ocb-wifi-mac.h"
-#include "ns3/wifi-80211p-helper.h"
-#include "ns3/wave-mac-helper.h"
 
-using namespace ns3;
+#include "junction-scenario.h"
+#include "junction-progress.h"
+#include "junction-pcap-ring.h"
+#include "junction-emu-bridge.h"
 
-int totalDelay = 0;
+using namespace ns3;
 
 AnimationInterface * anim = 0;
 
@@ -56,55 +57,6 @@ CourseChange (std:: string context, Ptr<const MobilityModel> model)
     " x = " << position.x << ", y = " << position.y);
 }
 
-//---------------------------------------------------------------------------------------
-//-- Calculates and returns the straight line distance (m) between two nodes and
-//-- returns as a double
-//---------------------------------------------------------------------------------------
-double
-CalcNodeDistance(Ptr<Node> node1, Ptr<Node> node2)
-{
-  Ptr<MobilityModel> model1 = node1->GetObject<MobilityModel>();
-  Ptr<MobilityModel> model2 = node2->GetObject<MobilityModel>();
-  double distance = model1->GetDistanceFrom (model2);
-  return distance;
-}
-
-//---------------------------------------------------------------------------------------
-//-- Callback function is called whenever a packet is received successfully.
-//---------------------------------------------------------------------------------------
-void ReceivePacket (Ptr<Node> node1, Ptr<Node> node2, Ptr<Socket> socket)
-{
-  Ptr<Packet> packet;
-  while (packet = socket->Recv ())
-    {
-
-      SeqTsHeader seqTs;
-      packet->RemoveHeader (seqTs);
-
-      //---------------------------------------------------------------------------------------
-      //-- Calculate delay, distance between nodes, and packet size
-      //---------------------------------------------------------------------------------------
-      int64_t now = Simulator::Now().GetNanoSeconds();
-      int64_t txTime = seqTs.GetTs().GetNanoSeconds();
-      int64_t delay = now - txTime;
-      ::totalDelay += delay;
-
-      double distance = CalcNodeDistance(node1, node2);
-
-      uint32_t size = packet->GetSize ();
-
-      //---------------------------------------------------------------------------------------
-      //-- Log data
-      //---------------------------------------------------------------------------------------
-      std::ofstream datafile ("v2x_analysis_log.txt", std::ios_base::app);
-      if (datafile.is_open())
-        {
-          datafile << "Packet received at time: " << now << " ns, Tx delay: " << delay << " ns, Tx distance: " << distance << " m, Packet Size: " << size << " bytes\n";
-        }       
-    }
-}
-
-
 //---------------------------------------------------------------------------------------
 //-- Currently not used, needs to be updated
 //---------------------------------------------------------------------------------------
@@ -147,44 +99,6 @@ void TurnLeft (Ptr<Node> node0)
 }
 */
 
-//---------------------------------------------------------------------------------------
-//-- Create Recursive Traffic Generator
-//---------------------------------------------------------------------------------------
-static void GenerateTraffic (Ptr<Socket> socket, uint32_t maxPktSize,
-                             uint32_t pktCount, Time pktInterval, 
-                             uint32_t totalData, uint32_t dataLeft)
-{
-  //---------------------------------------------------------------------------------------
-  //-- If packets left, send
-  //---------------------------------------------------------------------------------------
-  uint32_t pktSize = maxPktSize;
-  if (pktCount > 0)
-    {  
-      if (dataLeft < maxPktSize)
-        {
-          pktSize = dataLeft;
-        }
-      Ptr<Packet> pkt = Create<Packet> (pktSize);
-      SeqTsHeader hdr = SeqTsHeader();
-      pkt->AddHeader(hdr); 
-      socket->Send (pkt);
-      Simulator::Schedule (pktInterval, &GenerateTraffic,
-                           socket, maxPktSize, pktCount - 1, pktInterval, totalData, dataLeft - pktSize);
-    }
-  //---------------------------------------------------------------------------------------
-  //-- If no packets left, log data and close socket
-  //---------------------------------------------------------------------------------------
-  else
-    {
-      std::ofstream datafile ("EngJuncSize.csv", std::ios_base::app);
-      if (datafile.is_open())
-        {
-          datafile << totalData << ", " << ::totalDelay << "\n";
-        }
-      socket->Close ();
-    }
-}
-
 int 
 main (int argc, char *argv[])
 {
@@ -197,7 +111,31 @@ main (int argc, char *argv[])
   uint32_t numSensorNodes = 2;
   uint32_t numCarNodes = 1;
   double interval = 0.1; // seconds
-  Time interPacketInterval = Seconds (interval);
+  std::string totalsFile = "EngJuncSize.csv";
+
+  bool pcapEnable = false;
+  std::string pcapNodes = ""; // comma separated node IDs, empty = all
+  std::string pcapFrames = "all";
+  double pcapStart = 0; // seconds
+  double pcapStop = 0; // seconds, 0 = end of the run
+  uint32_t pcapRingSize = 256; // frames per device
+  double pcapPostTrigger = 0.1; // seconds
+  uint32_t pcapMaxDumps = 10;
+  double pcapDelayMs = 0; // ms, 0 = no delay trigger
+  bool pcapOnSeqGap = false;
+
+  bool realtime = false;
+  bool emuBridge = false;
+  uint16_t emuLocalPort = 9000; // host port the external RSU sends to
+  uint16_t emuPeerPort = 9001; // host port the external RSU listens on
+  double lagProbe = 0.01; // seconds
+  double lagLimit = 0.01; // seconds
+  bool emuEcho = false; // car echoes packets back towards the bridged RSU
+  uint32_t beaconSize = 300; // bytes
+  double beaconInterval = 0.1; // seconds
+  std::string traffic = "ip"; // ip = UDP broadcast, wsmp = raw OCB frames, no IP stack
+  double stop = 60; // seconds
+  ProgressReporter reporter;
   
   //-------------------------------------------------------------------------------------
   //-- Add options to change variables from the command line
@@ -207,7 +145,58 @@ main (int argc, char *argv[])
   cmd.AddValue("numCarNodes", "Number of car nodes", numCarNodes);
   cmd.AddValue("numSensorNodes", "Number of roadside sensor nodes", numSensorNodes);
   cmd.AddValue("maxPacketSize", "MTU of protocol (bytes)", maxPacketSize);
+  cmd.AddValue("interval", "Time between packets (s)", interval);
+  cmd.AddValue("stopTime", "Simulation stop time (s), must leave room for all of totalData", stop);
+  cmd.AddValue("phyMode", "Wifi Phy mode", phyMode);
+  cmd.AddValue("totalsFile", "File the total delay is appended to", totalsFile);
+  cmd.AddValue("traffic", "Traffic path: ip or wsmp", traffic);
+  reporter.AddCommandLineOptions (cmd);
+  cmd.AddValue("pcap", "Enable triggered ring-buffer pcap capture", pcapEnable);
+  cmd.AddValue("pcapNodes", "Node IDs to capture, e.g. 0,2 (empty = all)", pcapNodes);
+  cmd.AddValue("pcapFrames", "Frame types to capture: data,mgmt,ctl or all", pcapFrames);
+  cmd.AddValue("pcapStart", "Start of capture window (s)", pcapStart);
+  cmd.AddValue("pcapStop", "End of capture window (s), 0 = end of the run", pcapStop);
+  cmd.AddValue("pcapRingSize", "Frames kept per device", pcapRingSize);
+  cmd.AddValue("pcapPostTrigger", "Time to keep capturing after a trigger (s)", pcapPostTrigger);
+  cmd.AddValue("pcapMaxDumps", "Maximum number of pcap dumps per run", pcapMaxDumps);
+  cmd.AddValue("pcapDelayTrigger", "Dump when Tx delay exceeds this (ms), 0 = off", pcapDelayMs);
+  cmd.AddValue("pcapSeqTrigger", "Dump when a sequence number is missed", pcapOnSeqGap);
+  cmd.AddValue("realtime", "Run under the real-time simulator, every car beacons. Lag stats go to v2x_rt_lag.csv", realtime);
+  cmd.AddValue("beaconSize", "Size of each car's beacons in real-time mode (bytes)", beaconSize);
+  cmd.AddValue("beaconInterval", "Time between each car's beacons in real-time mode (s)", beaconInterval);
+  cmd.AddValue("emuBridge", "Bridge the RSU's traffic to a host UDP socket on 127.0.0.1 (needs --realtime)", emuBridge);
+  cmd.AddValue("emuLocalPort", "Host UDP port the bridge receives on", emuLocalPort);
+  cmd.AddValue("emuPeerPort", "Host UDP port the bridge sends to", emuPeerPort);
+  cmd.AddValue("emuEcho", "Car echoes received packets back to the RSU", emuEcho);
+  cmd.AddValue("lagProbe", "Real-time lag sampling period (s)", lagProbe);
+  cmd.AddValue("lagLimit", "Lag above which the simulation counts as behind (s)", lagLimit);
   cmd.Parse(argc, argv);
+  Time interPacketInterval = Seconds (interval);
+  Time stopTime = Seconds (stop);
+
+  //-------------------------------------------------------------------------------------
+  //-- Traffic starts at 2 s and the totals are written one interval after the last
+  //-- packet; a run that stops earlier leaves no result, so say so
+  //-------------------------------------------------------------------------------------
+  uint32_t numPackets = (totalData + maxPacketSize - 1) / maxPacketSize;
+  double trafficEnd = 2 + numPackets * interval;
+  if (!emuBridge && stop <= trafficEnd)
+    {
+      std::cerr << "Warning: stopTime " << stop << " s is not after the end of the traffic at "
+                << trafficEnd << " s, no totals will be written\n";
+    }
+
+  //-------------------------------------------------------------------------------------
+  //-- Real-time mode must be selected before anything touches the simulator
+  //-------------------------------------------------------------------------------------
+  NS_ABORT_MSG_IF (emuBridge && !realtime, "--emuBridge requires --realtime");
+  NS_ABORT_MSG_IF (emuBridge && traffic != "ip", "--emuBridge requires --traffic=ip");
+  NS_ABORT_MSG_IF (realtime && beaconInterval <= 0, "--beaconInterval must be positive");
+  if (realtime)
+    {
+      GlobalValue::Bind ("SimulatorImplementationType", StringValue ("ns3::RealtimeSimulatorImpl"));
+      Config::SetDefault ("ns3::RealtimeSimulatorImpl::SynchronizationMode", StringValue ("BestEffort"));
+    }
 
   //-------------------------------------------------------------------------------------
   //-- Create Nodes
@@ -221,21 +210,9 @@ main (int argc, char *argv[])
   //-------------------------------------------------------------------------------------
   //-- Set up the Wi-Fi NICs
   //-------------------------------------------------------------------------------------
-  YansWifiPhyHelper wifiPhy =  YansWifiPhyHelper::Default ();
-  YansWifiChannelHelper wifiChannel = YansWifiChannelHelper::Default ();
-  Ptr<YansWifiChannel> channel = wifiChannel.Create ();
-  wifiPhy.SetChannel (channel);
-  wifiPhy.SetPcapDataLinkType (WifiPhyHelper::DLT_IEEE802_11); // ns-3 supports pcap tracing
-  NqosWaveMacHelper wifi80211pMac = NqosWaveMacHelper::Default ();
-  Wifi80211pHelper wifi80211p = Wifi80211pHelper::Default ();
-
-  wifi80211p.SetRemoteStationManager ("ns3::ConstantRateWifiManager",
-                                      "DataMode",StringValue (phyMode),
-                                      "ControlMode",StringValue (phyMode));
-  NetDeviceContainer sensorDevices = wifi80211p.Install (wifiPhy, wifi80211pMac, sensorNodes);
-  sensorDevices = wifi80211p.Install (wifiPhy, wifi80211pMac, sensorNodes);
-  NetDeviceContainer carDevices = wifi80211p.Install (wifiPhy, wifi80211pMac, carNodes);
-  carDevices = wifi80211p.Install (wifiPhy, wifi80211pMac, carNodes);
+  JunctionScenario scenario (phyMode, ParseTrafficMode (traffic));
+  NetDeviceContainer sensorDevices = scenario.InstallDevices (sensorNodes);
+  NetDeviceContainer carDevices = scenario.InstallDevices (carNodes);
   
   //-------------------------------------------------------------------------------------
   //-- Set position of each node - TODO: Create function to do this
@@ -263,50 +240,85 @@ main (int argc, char *argv[])
   }
   
   //---------------------------------------------------------------------------------------
-  //-- Setup the Internet stack and assign IPV4 addresses
+  //-- Triggered pcap capture, only dumps to disk around a delay spike or missed packet
   //---------------------------------------------------------------------------------------
-  InternetStackHelper internet;
-  internet.Install (sensorNodes);
-  internet.Install (carNodes);
+  PcapRingCapture *pcapRing = 0;
+  if (pcapEnable)
+    {
+      pcapRing = new PcapRingCapture ("v2x-analysis", pcapRingSize);
+      pcapRing->SetNodeFilter (pcapNodes);
+      pcapRing->SetFrameFilter (pcapFrames);
+      pcapRing->SetTimeWindow (Seconds (pcapStart), pcapStop > 0 ? Seconds (pcapStop) : Time::Max ());
+      pcapRing->SetDumpPolicy (Seconds (pcapPostTrigger), pcapMaxDumps);
+      pcapRing->Install (scenario.GetDevices ());
+    }
 
-  Ipv4AddressHelper ipv4;
+  //---------------------------------------------------------------------------------------
+  //-- Setup the Internet stack and assign IPV4 addresses (skipped for wsmp traffic)
+  //---------------------------------------------------------------------------------------
   NS_LOG_INFO ("Assign IP Addresses.");
-  ipv4.SetBase ("10.1.1.0", "255.255.255.0");
-  Ipv4InterfaceContainer sensorInterfaces = ipv4.Assign (sensorDevices);
-  ipv4.SetBase ("10.1.2.0", "255.255.255.0"); // Should the cars and rsu be of the same base address?
-  Ipv4InterfaceContainer carInterfaces = ipv4.Assign (carDevices);
+  Ipv4InterfaceContainer sensorInterfaces = scenario.InstallInternet (sensorDevices, "10.1.1.0");
+  Ipv4InterfaceContainer carInterfaces = scenario.InstallInternet (carDevices, "10.1.2.0"); // Should the cars and rsu be of the same base address?
 
   //---------------------------------------------------------------------------------------
-  //-- Setup socket connection and callback when packets are received by the source
+  //-- Setup socket connection and callback when packets are received by the source.
+  //-- Measures total delay and a per-packet trace, and feeds the pcap trigger.
   //---------------------------------------------------------------------------------------
-  TypeId tid = TypeId::LookupByName ("ns3::UdpSocketFactory");
-  Ptr<Socket> recvSink = Socket::CreateSocket (carNodes.Get (0), tid);
-  InetSocketAddress local = InetSocketAddress (Ipv4Address::GetAny (), 80);
-  recvSink->Bind (local);
-  recvSink->SetRecvCallback (MakeBoundCallback (&ReceivePacket, sensorNodes.Get (1), carNodes.Get (0)));
-
-  Ptr<Socket> source = Socket::CreateSocket (sensorNodes.Get (1), tid);
-  InetSocketAddress remote = InetSocketAddress (Ipv4Address ("255.255.255.255"), 80);
-  source->SetAllowBroadcast (true);
-  source->Connect (remote);
+  typedef SinkPair<TotalsSink, SinkPair<PacketTraceSink, PcapTriggerSink> > Measure;
+  TotalsSink totals (totalsFile);
+  PacketTraceSink trace ("v2x_analysis_log.csv");
+  PcapTriggerSink pcapTrigger (pcapRing, Seconds (pcapDelayMs / 1000.0), pcapOnSeqGap);
+  SinkPair<PacketTraceSink, PcapTriggerSink> traceAndTrigger (trace, pcapTrigger);
+  Measure measure (totals, traceAndTrigger);
+
+  JunctionReceiver<Measure> receiver (measure, sensorNodes.Get (1), carNodes.Get (0));
+  scenario.ConnectReceiver (receiver, carDevices.Get (0), 80);
+  if (emuEcho)
+    {
+      receiver.EnableEcho (80);
+    }
 
   //---------------------------------------------------------------------------------------
-  //-- Calc number of packets needed, if there's a remainder since the datatypes are ints,
-  //-- the program will round down, this is accounted for in the if loop
+  //-- Begin generating traffic, or hand the RSU's sockets to the external application
   //---------------------------------------------------------------------------------------
-  uint32_t numPackets = totalData/maxPacketSize;
-  if (std::abs(std::remainder(totalData, maxPacketSize)) != 0)
-   {
-     ++numPackets;
-   }
+  TrafficGenerator generator (maxPacketSize, interPacketInterval);
+  Ptr<LoopbackBridge> bridge;
+  if (emuBridge)
+    {
+      Ptr<Socket> bridgeSource = scenario.CreateBroadcastSource (sensorNodes.Get (1), 80);
+      Ptr<Socket> bridgeSink = scenario.CreateSink (sensorNodes.Get (1), 80);
+      bridge = Create<LoopbackBridge> (emuLocalPort, emuPeerPort);
+      bridge->Start (bridgeSource, bridgeSink);
+    }
+  else
+    {
+      scenario.ConnectSender (generator, sensorDevices.Get (1), 80);
+      generator.SetDoneCallback (MakeCallback (&Measure::OnTrafficDone, &measure));
+      generator.Start (Seconds (2), totalData);
+    }
 
   //---------------------------------------------------------------------------------------
-  //-- Begin generating traffic
+  //-- In real-time mode every car beacons for the whole run, so the lag stats grow with
+  //-- numCarNodes. Beacons go to port 81 (BEACON_PROTOCOL for wsmp), so car 0's
+  //-- measurements only see the RSU's traffic. Start times are spread over one interval.
   //---------------------------------------------------------------------------------------
-  Simulator::ScheduleWithContext (source->GetNode ()->GetId (),
-                                  Seconds (2), &GenerateTraffic,
-                                  source, maxPacketSize, numPackets, 
-                                  interPacketInterval, totalData, totalData);
+  std::vector<TrafficGenerator> beacons;
+  if (realtime)
+    {
+      uint32_t numBeacons = (uint32_t)std::ceil (stop / beaconInterval);
+      beacons.assign (numCarNodes, TrafficGenerator (beaconSize, Seconds (beaconInterval)));
+      for (uint32_t i = 0; i < numCarNodes; ++i)
+        {
+          scenario.ConnectBeacon (beacons[i], carDevices.Get (i), 81);
+          beacons[i].Start (Seconds (rvar->GetValue (0, beaconInterval)), beaconSize * numBeacons);
+        }
+    }
+
+  RealtimeLagMonitor lagMonitor (Seconds (lagProbe), Seconds (lagLimit));
+  if (realtime)
+    {
+      lagMonitor.Start (Seconds (0));
+    }
 
   //TODO: Edit current "turn left" function to produce random turns
   
@@ -339,16 +351,40 @@ main (int argc, char *argv[])
     }
   
   //---------------------------------------------------------------------------------------
-  //-- Apply flowmonitor tracing, currently not working
+  //-- Apply flowmonitor tracing, currently not working. Only IP flows can be monitored.
   //---------------------------------------------------------------------------------------
   Ptr<FlowMonitor> flowMonitor;
   FlowMonitorHelper flowHelper;
-  flowMonitor = flowHelper.InstallAll();
+  if (scenario.GetTrafficMode () == TRAFFIC_IP)
+    {
+      flowMonitor = flowHelper.InstallAll();
+    }
   
-  Simulator::Stop (Seconds (60));
+  reporter.Start (stopTime, MakeCallback (&TrafficGenerator::GetSent, &generator),
+                  MakeCallback (&JunctionReceiver<Measure>::GetReceived, &receiver));
+
+  Simulator::Stop (stopTime);
 
   Simulator::Run ();
-  flowMonitor->SerializeToXmlFile("EngJuncFM.xml", true, true);
+  if (pcapRing)
+    {
+      pcapRing->Flush ();
+    }
+  if (flowMonitor)
+    {
+      flowMonitor->SerializeToXmlFile("EngJuncFM.xml", true, true);
+    }
+  if (bridge)
+    {
+      bridge->Stop ();
+      std::cout << "Bridge: " << bridge->GetFromHost () << " packets from host, "
+                << bridge->GetToHost () << " packets to host\n";
+    }
+  if (realtime)
+    {
+      lagMonitor.Report ("v2x_rt_lag.csv", numCarNodes);
+    }
   Simulator::Destroy ();
+  delete pcapRing;
   return 0;
 }
@@ -1,33 +1,400 @@
 #!/usr/bin/python
 
+#---------------------------------------------------------------------------------------
+#-- Parameter sweeps for scratch/v2x-analysis.
+#--
+#-- Grid over totalData (original behaviour):
+#--   ./v2x-analysis.py [max_data] [step] [sub_runs] [processes]
+#--
+#-- Design of experiments over several parameters: an initial Latin-hypercube or Sobol
+#-- batch, then optional adaptive rounds. Each round fits a Gaussian-process surrogate
+#-- of the total delay and runs the candidates where the surrogate is least certain or
+#-- changes fastest:
+#--   ./v2x-analysis.py --design sobol --samples 32 --rounds 4 --batch 8 \
+#--       --param totalData=1500:60000:int --param numCarNodes=1:20:int \
+#--       --param maxPacketSize=200:1500:int --param interval=0.01:1:log \
+#--       --param phyMode=OfdmRate6MbpsBW10MHz,OfdmRate12MbpsBW10MHz
+#--
+#-- Parameters are name=low:high[:int][:log] or name=choice1,choice2,... Results are
+#-- appended to --out, one line per design point. Unless stopTime is itself a parameter,
+#-- each run gets a stop time long enough to send all of its totalData plus --stop-margin.
+#---------------------------------------------------------------------------------------
+
+from __future__ import print_function
+
 import sys
 import os
+import math
+import random
+import argparse
 from multiprocessing import Pool
-	
+
+#---------------------------------------------------------------------------------------
+#-- Original grid sweep over totalData
+#---------------------------------------------------------------------------------------
 def start_simulation(data):
 	run = data[0]
 	sub_run = data[1]
 	current_data = data[2]
-        os.system('./waf --command-template="%%s --totalData=%d --RngRun=%d" --run scratch/v2x-analysis' % (current_data, sub_run))
-
-if len(sys.argv) != 5:
-	print "usage: ./parallel [max_data] [step] [sub_runs] [processes]"
-	sys.exit(0)
-
-max_data = int(sys.argv[1])
-step = int(sys.argv[2])
-sub_runs = int(sys.argv[3])
-processes = int(sys.argv[4])
-
-# create params
-params = []
-run = 1
-for i in range(0, max_data+step, step):
-	current_data = i
-	for j in range(sub_runs):
-		params.append([run, j+1, current_data])
-	run += 1
-
-# run
-pool = Pool(processes=processes)
-pool.map(start_simulation, params)
+	os.system('./waf --command-template="%%s --totalData=%d --RngRun=%d" --run scratch/v2x-analysis' % (current_data, sub_run))
+
+def grid_sweep(argv):
+	max_data = int(argv[0])
+	step = int(argv[1])
+	sub_runs = int(argv[2])
+	processes = int(argv[3])
+
+	# create params
+	params = []
+	run = 1
+	for i in range(0, max_data+step, step):
+		current_data = i
+		for j in range(sub_runs):
+			params.append([run, j+1, current_data])
+		run += 1
+
+	# run
+	pool = Pool(processes=processes)
+	pool.map(start_simulation, params)
+
+#---------------------------------------------------------------------------------------
+#-- Parameter space: maps points in the unit cube to simulation arguments
+#---------------------------------------------------------------------------------------
+class Param(object):
+	def __init__(self, spec):
+		if '=' not in spec:
+			raise ValueError('bad --param %r, expected name=low:high or name=a,b' % spec)
+		self.name, rng = spec.split('=', 1)
+		self.choices = None
+		self.is_int = False
+		self.is_log = False
+		if ',' in rng:
+			self.choices = rng.split(',')
+			return
+		fields = rng.split(':')
+		if len(fields) < 2:
+			raise ValueError('bad --param %r, expected name=low:high' % spec)
+		self.low = float(fields[0])
+		self.high = float(fields[1])
+		for flag in fields[2:]:
+			if flag == 'int':
+				self.is_int = True
+			elif flag == 'log':
+				self.is_log = True
+			else:
+				raise ValueError('bad --param flag %r in %r' % (flag, spec))
+		if self.is_log and self.low <= 0:
+			raise ValueError('log scale needs low > 0 in %r' % spec)
+
+	def value(self, u):
+		if self.choices is not None:
+			return self.choices[min(int(u * len(self.choices)), len(self.choices) - 1)]
+		if self.is_log:
+			v = math.exp(math.log(self.low) + u * (math.log(self.high) - math.log(self.low)))
+		else:
+			v = self.low + u * (self.high - self.low)
+		if self.is_int:
+			return int(round(v))
+		return v
+
+#---------------------------------------------------------------------------------------
+#-- Space-filling designs, all points in [0, 1)^dim
+#---------------------------------------------------------------------------------------
+def latin_hypercube(n, dim, rng):
+	columns = []
+	for d in range(dim):
+		strata = [(i + rng.random()) / n for i in range(n)]
+		rng.shuffle(strata)
+		columns.append(strata)
+	return [[columns[d][i] for d in range(dim)] for i in range(n)]
+
+# Joe & Kuo direction numbers (s, a, m) for dimensions 2..8
+SOBOL_DIRECTIONS = [
+	(1, 0, [1]),
+	(2, 1, [1, 3]),
+	(3, 1, [1, 3, 1]),
+	(3, 2, [1, 1, 1]),
+	(4, 1, [1, 1, 3, 3]),
+	(4, 4, [1, 3, 5, 13]),
+	(5, 2, [1, 1, 5, 5, 17]),
+]
+SOBOL_BITS = 32
+
+def sobol_vectors(d):
+	if d == 0:
+		return [1 << (SOBOL_BITS - i) for i in range(1, SOBOL_BITS + 1)]
+	s, a, m = SOBOL_DIRECTIONS[d - 1]
+	v = [0] * (SOBOL_BITS + 1)
+	for i in range(1, s + 1):
+		v[i] = m[i - 1] << (SOBOL_BITS - i)
+	for i in range(s + 1, SOBOL_BITS + 1):
+		v[i] = v[i - s] ^ (v[i - s] >> s)
+		for k in range(1, s):
+			v[i] ^= ((a >> (s - 1 - k)) & 1) * v[i - k]
+	return v[1:]
+
+def sobol(n, dim, rng, skip=0):
+	if dim > len(SOBOL_DIRECTIONS) + 1:
+		raise ValueError('Sobol design supports up to %d parameters' % (len(SOBOL_DIRECTIONS) + 1))
+	vectors = [sobol_vectors(d) for d in range(dim)]
+	# random digital shift keeps the net structure but varies the points between seeds
+	shift = [rng.getrandbits(SOBOL_BITS) for d in range(dim)]
+	x = [0] * dim
+	points = []
+	# index 0 is the all-zero point, start at 1
+	for i in range(1, skip + n + 1):
+		c = 0
+		j = i - 1
+		while j & 1:
+			j >>= 1
+			c += 1
+		for d in range(dim):
+			x[d] ^= vectors[d][c]
+		if i > skip:
+			points.append([float(x[d] ^ shift[d]) / (1 << SOBOL_BITS) for d in range(dim)])
+	return points
+
+#---------------------------------------------------------------------------------------
+#-- Gaussian-process surrogate, squared exponential kernel on the unit cube. Length
+#-- scale and noise are picked from a small grid by marginal likelihood. Pure Python,
+#-- sized for the hundreds of runs an adaptive design needs.
+#---------------------------------------------------------------------------------------
+def cholesky(a):
+	n = len(a)
+	l = [[0.0] * n for i in range(n)]
+	for i in range(n):
+		for j in range(i + 1):
+			s = a[i][j] - sum(l[i][k] * l[j][k] for k in range(j))
+			if i == j:
+				if s <= 0:
+					return None
+				l[i][i] = math.sqrt(s)
+			else:
+				l[i][j] = s / l[j][j]
+	return l
+
+def forward(l, b):
+	y = []
+	for i in range(len(b)):
+		y.append((b[i] - sum(l[i][k] * y[k] for k in range(i))) / l[i][i])
+	return y
+
+def backward(l, y):
+	n = len(y)
+	x = [0.0] * n
+	for i in reversed(range(n)):
+		x[i] = (y[i] - sum(l[k][i] * x[k] for k in range(i + 1, n))) / l[i][i]
+	return x
+
+def sq_dist(a, b):
+	return sum((ai - bi) ** 2 for ai, bi in zip(a, b))
+
+class GaussianProcess(object):
+	LENGTH_SCALES = [0.05, 0.1, 0.2, 0.4, 0.8, 1.6]
+	NOISES = [1e-4, 1e-2, 1e-1]
+
+	def fit(self, xs, ys):
+		self.xs = xs
+		self.mean = sum(ys) / len(ys)
+		var = sum((y - self.mean) ** 2 for y in ys) / len(ys)
+		self.scale = math.sqrt(var) if var > 0 else 1.0
+		z = [(y - self.mean) / self.scale for y in ys]
+		n = len(xs)
+		best = None
+		for ls in self.LENGTH_SCALES:
+			for noise in self.NOISES:
+				k = [[math.exp(-sq_dist(xs[i], xs[j]) / (2 * ls * ls)) + (noise if i == j else 0.0)
+				      for j in range(n)] for i in range(n)]
+				l = cholesky(k)
+				if l is None:
+					continue
+				alpha = backward(l, forward(l, z))
+				lml = (-0.5 * sum(zi * ai for zi, ai in zip(z, alpha))
+				       - sum(math.log(l[i][i]) for i in range(n)))
+				if best is None or lml > best[0]:
+					best = (lml, ls, noise, l, alpha)
+		if best is None:
+			raise RuntimeError('surrogate fit failed')
+		self.lml, self.ls, self.noise, self.l, self.alpha = best
+
+	def kernel_vector(self, x):
+		return [math.exp(-sq_dist(x, xi) / (2 * self.ls * self.ls)) for xi in self.xs]
+
+	def mean_at(self, x):
+		k = self.kernel_vector(x)
+		return self.mean + self.scale * sum(ki * ai for ki, ai in zip(k, self.alpha))
+
+	def predict(self, x):
+		k = self.kernel_vector(x)
+		mu = self.mean + self.scale * sum(ki * ai for ki, ai in zip(k, self.alpha))
+		v = forward(self.l, k)
+		var = max(1.0 + self.noise - sum(vi * vi for vi in v), 0.0)
+		return mu, self.scale * math.sqrt(var)
+
+	def gradient_norm(self, x, h=0.01):
+		g = 0.0
+		for d in range(len(x)):
+			up = list(x)
+			down = list(x)
+			up[d] = min(up[d] + h, 1.0)
+			down[d] = max(down[d] - h, 0.0)
+			g += ((self.mean_at(up) - self.mean_at(down)) / (up[d] - down[d])) ** 2
+		return math.sqrt(g)
+
+#---------------------------------------------------------------------------------------
+#-- Pick 'batch' candidates with the highest normalised uncertainty plus weighted
+#-- gradient. Candidates close to an already picked point are penalised so a batch
+#-- spreads out instead of piling onto one peak.
+#---------------------------------------------------------------------------------------
+def select_batch(gp, candidates, batch, gradient_weight):
+	stds = [gp.predict(c)[1] for c in candidates]
+	grads = [gp.gradient_norm(c) for c in candidates] if gradient_weight > 0 else [0.0] * len(candidates)
+	max_std = max(stds) or 1.0
+	max_grad = max(grads) or 1.0
+	scores = [s / max_std + gradient_weight * g / max_grad for s, g in zip(stds, grads)]
+
+	picked = []
+	for b in range(min(batch, len(candidates))):
+		best = max(range(len(candidates)), key=lambda i: scores[i])
+		picked.append(candidates[best])
+		for i in range(len(candidates)):
+			scores[i] *= 1.0 - math.exp(-sq_dist(candidates[i], candidates[best]) / (2 * gp.ls * gp.ls))
+	return picked
+
+#---------------------------------------------------------------------------------------
+#-- Stop time for a design point: traffic starts at 2 s and sends ceil(totalData /
+#-- maxPacketSize) packets one interval apart. Defaults match scratch/v2x-analysis.cc
+#---------------------------------------------------------------------------------------
+PROGRAM_DEFAULTS = {'totalData': 15000, 'maxPacketSize': 1500, 'interval': 0.1}
+
+def stop_time(args, margin):
+	values = dict(PROGRAM_DEFAULTS)
+	values.update((name, value) for name, value in args if name in values)
+	packets = int(math.ceil(float(values['totalData']) / float(values['maxPacketSize'])))
+	return 2 + packets * float(values['interval']) + margin
+
+#---------------------------------------------------------------------------------------
+#-- Run one simulation and return its total delay (ns), or None if it produced nothing
+#---------------------------------------------------------------------------------------
+def run_design_point(job):
+	run_id, sub_run, args, options = job
+	results = os.path.join(options['workdir'], 'run-%d-%d.csv' % (run_id, sub_run))
+	if os.path.exists(results):
+		os.remove(results)
+	arg_string = ' '.join('--%s=%s' % (name, value) for name, value in args)
+	os.system('%s --command-template="%%s %s --totalsFile=%s --RngRun=%d" --run %s > /dev/null'
+	          % (options['waf'], arg_string, os.path.abspath(results), sub_run, options['program']))
+	if not os.path.exists(results):
+		return None
+	with open(results) as f:
+		lines = [line for line in f if line.strip()]
+	if not lines:
+		return None
+	return float(lines[-1].split(',')[1])
+
+def run_batch(pool, points, params, first_id, options):
+	jobs = []
+	for i, u in enumerate(points):
+		args = [(p.name, p.value(ui)) for p, ui in zip(params, u)]
+		if 'stopTime' not in [name for name, value in args]:
+			args.append(('stopTime', stop_time(args, options['stop_margin'])))
+		for sub_run in range(1, options['sub_runs'] + 1):
+			jobs.append((first_id + i, sub_run, args, options))
+	outputs = pool.map(run_design_point, jobs)
+
+	responses = []
+	for i in range(len(points)):
+		runs = [r for r in outputs[i * options['sub_runs']:(i + 1) * options['sub_runs']] if r is not None]
+		responses.append(sum(runs) / len(runs) if runs else None)
+	return responses
+
+#---------------------------------------------------------------------------------------
+#-- Failed points are kept in --out with an empty response but left out of the surrogate
+#---------------------------------------------------------------------------------------
+def report_round(round_no, first_id, responses, extra=''):
+	failed = [first_id + i for i, y in enumerate(responses) if y is None]
+	print('round %d: %d runs, %d failed%s' % (round_no, len(responses), len(failed), extra))
+	if failed:
+		print('  failed runs: %s' % ', '.join(str(run_id) for run_id in failed))
+	return len(failed)
+
+def write_results(path, round_no, first_id, points, params, responses):
+	new_file = not os.path.exists(path)
+	with open(path, 'a') as f:
+		if new_file:
+			f.write('round, run, %s, totalDelay\n' % ', '.join(p.name for p in params))
+		for i, (u, y) in enumerate(zip(points, responses)):
+			values = ', '.join(str(p.value(ui)) for p, ui in zip(params, u))
+			f.write('%d, %d, %s, %s\n' % (round_no, first_id + i, values, '' if y is None else repr(y)))
+
+def design_sweep(argv):
+	parser = argparse.ArgumentParser(description='Design of experiments for scratch/v2x-analysis')
+	parser.add_argument('--design', choices=['lhs', 'sobol'], default='sobol')
+	parser.add_argument('--param', action='append', required=True,
+	                    help='name=low:high[:int][:log] or name=a,b,c (repeatable)')
+	parser.add_argument('--samples', type=int, default=32, help='size of the initial design')
+	parser.add_argument('--rounds', type=int, default=0, help='adaptive rounds after the initial design')
+	parser.add_argument('--batch', type=int, default=8, help='runs per adaptive round')
+	parser.add_argument('--candidates', type=int, default=256, help='candidate points scored per round')
+	parser.add_argument('--gradient-weight', type=float, default=0.5,
+	                    help='weight of the surrogate gradient against its uncertainty')
+	parser.add_argument('--sub-runs', type=int, default=1, help='RngRun repetitions per point')
+	parser.add_argument('--stop-margin', type=float, default=5,
+	                    help='seconds added to the computed stop time of each run')
+	parser.add_argument('--processes', type=int, default=1)
+	parser.add_argument('--seed', type=int, default=1)
+	parser.add_argument('--out', default='v2x-sweep.csv')
+	parser.add_argument('--workdir', default='v2x-sweep-runs')
+	parser.add_argument('--waf', default='./waf')
+	parser.add_argument('--program', default='scratch/v2x-analysis')
+	opts = parser.parse_args(argv)
+
+	params = [Param(spec) for spec in opts.param]
+	rng = random.Random(opts.seed)
+	if not os.path.isdir(opts.workdir):
+		os.makedirs(opts.workdir)
+	options = {'workdir': opts.workdir, 'waf': opts.waf, 'program': opts.program,
+	           'sub_runs': opts.sub_runs, 'stop_margin': opts.stop_margin}
+	pool = Pool(processes=opts.processes)
+
+	def design(n, skip=0):
+		if opts.design == 'sobol':
+			return sobol(n, len(params), rng, skip)
+		return latin_hypercube(n, len(params), rng)
+
+	xs = design(opts.samples)
+	ys = run_batch(pool, xs, params, 1, options)
+	write_results(opts.out, 0, 1, xs, params, ys)
+	next_id = len(xs) + 1
+	failed = report_round(0, 1, ys)
+
+	for round_no in range(1, opts.rounds + 1):
+		known = [(x, y) for x, y in zip(xs, ys) if y is not None]
+		if len(known) < 2:
+			print('not enough successful runs to fit a surrogate, stopping')
+			break
+		gp = GaussianProcess()
+		gp.fit([x for x, y in known], [y for x, y in known])
+		candidates = design(opts.candidates, skip=len(xs) + round_no * opts.candidates)
+		batch = select_batch(gp, candidates, opts.batch, opts.gradient_weight)
+
+		responses = run_batch(pool, batch, params, next_id, options)
+		write_results(opts.out, round_no, next_id, batch, params, responses)
+		next_id += len(batch)
+		xs += batch
+		ys += responses
+		failed += report_round(round_no, next_id - len(batch), responses,
+		                       ', length scale %.2f, noise %g' % (gp.ls, gp.noise))
+
+	if failed:
+		print('%d of %d runs failed, see the empty responses in %s' % (failed, len(xs), opts.out))
+
+if __name__ == '__main__':
+	if len(sys.argv) == 5 and all(arg.isdigit() for arg in sys.argv[1:]):
+		grid_sweep(sys.argv[1:])
+	elif len(sys.argv) > 1 and sys.argv[1].startswith('--'):
+		design_sweep(sys.argv[1:])
+	else:
+		print("usage: ./parallel [max_data] [step] [sub_runs] [processes]")
+		print("       ./v2x-analysis.py --param name=low:high[:int][:log] ... (see --help)")
+		sys.exit(0)